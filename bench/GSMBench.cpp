@@ -0,0 +1,235 @@
+#include "CodeGen.h"
+#include "FlatAST.h"
+#include "Parser.h"
+#include "ProgramGenerator.h"
+#include "Sema.h"
+#include "Simplify.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+
+// Define a command-line option for the program shapes to measure (default: all).
+static llvm::cl::list<ProgramGenerator::Shape>
+    Shapes("shape",
+           llvm::cl::desc("Program shapes to benchmark (default: all)"),
+           llvm::cl::CommaSeparated,
+           llvm::cl::values(
+               clEnumValN(ProgramGenerator::Decls, "decls", "Multi-variable declarations"),
+               clEnumValN(ProgramGenerator::Exprs, "exprs", "Deeply nested expressions"),
+               clEnumValN(ProgramGenerator::IfChains, "if-chains", "Long if/elif/else chains"),
+               clEnumValN(ProgramGenerator::Loops, "loops", "Loops with several assignments"),
+               clEnumValN(ProgramGenerator::Comments, "comments", "Long block comments between statements")));
+
+// Define command-line options for the range of input sizes; each size is Step times the previous one.
+static llvm::cl::opt<uint64_t>
+    MinSize("min-size",
+            llvm::cl::desc("Smallest generated program in bytes (default = 1 KB)"),
+            llvm::cl::init(1 << 10));
+
+static llvm::cl::opt<uint64_t>
+    MaxSize("max-size",
+            llvm::cl::desc("Largest generated program in bytes (default = 100 MB)"),
+            llvm::cl::init(100 << 20));
+
+static llvm::cl::opt<unsigned>
+    Step("step",
+         llvm::cl::desc("Factor between consecutive sizes (default = 10)"),
+         llvm::cl::init(10));
+
+// Define a command-line option for the seed of the program generator.
+static llvm::cl::opt<uint64_t>
+    Seed("seed",
+         llvm::cl::desc("Seed of the program generator"),
+         llvm::cl::init(1));
+
+// Define a command-line option for how long each size is repeated; the fastest run of each phase is reported.
+static llvm::cl::opt<double>
+    MinTime("min-time",
+            llvm::cl::desc("Repeat each size for at least this many seconds (default = 0.5)"),
+            llvm::cl::init(0.5));
+
+// Define a command-line option for printing a generated program instead of measuring.
+static llvm::cl::opt<bool>
+    Dump("dump",
+         llvm::cl::desc("Print the program of the first shape and the smallest size, then exit"),
+         llvm::cl::init(false));
+
+// Define a command-line option for where the JSON report is written.
+static llvm::cl::opt<std::string>
+    OutputFilename("o",
+                   llvm::cl::desc("Output file for the JSON report (default: stdout)"),
+                   llvm::cl::value_desc("filename"),
+                   llvm::cl::init("-"));
+
+namespace
+{
+enum Phase
+{
+  LexPhase,
+  ParsePhase,
+  SemaPhase,
+  SimplifyPhase,
+  CodeGenPhase,
+  NumPhases
+};
+
+const char *const PhaseNames[NumPhases] = {"lex", "parse", "sema", "simplify", "codegen"};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point Start)
+{
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+struct Result
+{
+  size_t Bytes = 0;
+  size_t Tokens = 0;
+  size_t Nodes = 0;
+  unsigned Runs = 0;
+  double Best[NumPhases];
+};
+
+// Run every phase over Program until MinTime has passed and keep the fastest
+// time of each phase. Returns true if the generated program does not compile.
+bool measure(llvm::StringRef Program, Result &R)
+{
+  R.Bytes = Program.size();
+  for (double &T : R.Best)
+    T = 1e300;
+
+  double Total = 0;
+  do
+  {
+    double Times[NumPhases];
+    Clock::time_point Start = Clock::now();
+
+    Lexer Lex(Program);
+    auto Tokens = std::make_unique<TokenStream>();
+    Lex.lexAll(*Tokens);
+    Times[LexPhase] = secondsSince(Start);
+
+    ASTContext Context;
+    Start = Clock::now();
+    Parser Parser(*Tokens, Context);
+    AST *Tree = Parser.parse();
+    Times[ParsePhase] = secondsSince(Start);
+    if (!Tree || Parser.hasError())
+      return true;
+    if (!R.Runs)
+      R.Tokens = Tokens->size();
+    Tokens.reset(); // keep the peak memory of the large sizes down
+
+    Start = Clock::now();
+    Sema Semantic;
+    if (Semantic.semantic(Tree, Context.getSymbols()))
+      return true;
+    Times[SemaPhase] = secondsSince(Start);
+
+    // The parsed tree stays in the context, node counts refer to it.
+    Start = Clock::now();
+    AST *Simplified = Simplify().simplify(Tree, Context);
+    Times[SimplifyPhase] = secondsSince(Start);
+
+    llvm::LLVMContext Ctx;
+    Start = Clock::now();
+    std::unique_ptr<llvm::Module> M = CodeGen().compile(Simplified, Context.getSymbols(), Ctx);
+    Times[CodeGenPhase] = secondsSince(Start);
+    if (!M)
+      return true;
+
+    M.reset();
+    if (!R.Runs++)
+      R.Nodes = FlatAST::build(Tree, Context.getSymbols()).size();
+    for (unsigned P = 0; P != NumPhases; ++P)
+    {
+      R.Best[P] = std::min(R.Best[P], Times[P]);
+      Total += Times[P];
+    }
+  } while (Total < MinTime);
+  return false;
+}
+
+void report(llvm::json::OStream &J, ProgramGenerator::Shape S, const Result &R)
+{
+  J.object([&] {
+    J.attribute("shape", ProgramGenerator::getShapeName(S));
+    J.attribute("bytes", int64_t(R.Bytes));
+    J.attribute("tokens", int64_t(R.Tokens));
+    J.attribute("nodes", int64_t(R.Nodes));
+    J.attribute("runs", int64_t(R.Runs));
+    J.attributeObject("phases", [&] {
+      double Total = 0;
+      auto Phase = [&](const char *Name, double Seconds) {
+        J.attributeObject(Name, [&] {
+          J.attribute("seconds", Seconds);
+          J.attribute("mb_per_s", R.Bytes / 1e6 / Seconds);
+          J.attribute("nodes_per_s", R.Nodes / Seconds);
+        });
+      };
+      for (unsigned P = 0; P != NumPhases; ++P)
+      {
+        Phase(PhaseNames[P], R.Best[P]);
+        Total += R.Best[P];
+      }
+      Phase("total", Total);
+    });
+  });
+}
+} // namespace
+
+int main(int argc, const char **argv)
+{
+  llvm::InitLLVM X(argc, argv);
+  llvm::cl::ParseCommandLineOptions(argc, argv, "GSM compiler benchmarks\n");
+
+  if (Shapes.empty())
+    for (unsigned S = ProgramGenerator::Decls; S <= ProgramGenerator::Comments; ++S)
+      Shapes.push_back(ProgramGenerator::Shape(S));
+  if (Step < 2)
+  {
+    llvm::errs() << "Error: --step must be at least 2\n";
+    return 1;
+  }
+
+  if (Dump)
+  {
+    llvm::outs() << ProgramGenerator(Seed).generate(Shapes.front(), MinSize);
+    return 0;
+  }
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(OutputFilename, EC, llvm::sys::fs::OF_Text);
+  if (EC)
+  {
+    llvm::errs() << "Error: cannot open " << OutputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  llvm::json::OStream J(OS, 2);
+  J.object([&] {
+    J.attribute("seed", int64_t(Seed));
+    J.attributeArray("benchmarks", [&] {
+      for (ProgramGenerator::Shape S : Shapes)
+        for (uint64_t Size = MinSize; Size <= MaxSize; Size *= Step)
+        {
+          Result R;
+          std::string Program = ProgramGenerator(Seed).generate(S, Size);
+          if (measure(Program, R))
+          {
+            llvm::errs() << "Error: generated " << ProgramGenerator::getShapeName(S)
+                         << " program of " << Size << " bytes does not compile\n";
+            exit(1);
+          }
+          report(J, S, R);
+          OS.flush();
+        }
+    });
+  });
+  OS << "\n";
+  return 0;
+}
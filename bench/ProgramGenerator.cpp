@@ -0,0 +1,209 @@
+#include "ProgramGenerator.h"
+
+// Variables declared at the start of every program except Decls.
+static const char *const Vars[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
+static const unsigned NumVars = sizeof(Vars) / sizeof(Vars[0]);
+
+// Comparisons only appear in conditions; and/or in integer expressions yield
+// 0 or 1 like in conditions, which exercises their short-circuit lowering too.
+static const char *const IntOps[] = {"+", "-", "*", "/", "%", "^", "and", "or"};
+static const char *const CmpOps[] = {"==", "!=", "<", ">", "<=", ">="};
+static const char *const BoolOps[] = {"and", "or"};
+
+uint64_t ProgramGenerator::next()
+{
+  // splitmix64, fully specified so the programs do not depend on the standard library
+  uint64_t Z = (State += 0x9e3779b97f4a7c15ULL);
+  Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+  return Z ^ (Z >> 31);
+}
+
+void ProgramGenerator::var() { Out += Vars[below(NumVars)]; }
+
+void ProgramGenerator::expr(unsigned Depth)
+{
+  if (Depth == 0)
+  {
+    if (below(2))
+      var();
+    else
+      Out += std::to_string(below(100));
+    return;
+  }
+  const char *Op = IntOps[below(sizeof(IntOps) / sizeof(IntOps[0]))];
+  llvm::StringRef OpRef(Op);
+  if (OpRef == "/" || OpRef == "%" || OpRef == "^")
+  {
+    // keep divisors and exponents small non-zero literals
+    Out += '(';
+    expr(Depth - 1);
+    Out += ") ";
+    Out += Op;
+    Out += ' ';
+    Out += std::to_string(1 + below(9));
+    return;
+  }
+  // Usually only one operand is nested further, so the depth grows much faster
+  // than the width of the tree.
+  bool Wide = below(8) == 0;
+  bool LeftDeep = below(2);
+  Out += '(';
+  expr(LeftDeep || Wide ? Depth - 1 : 0);
+  Out += ' ';
+  Out += Op;
+  Out += ' ';
+  expr(!LeftDeep || Wide ? Depth - 1 : 0);
+  Out += ')';
+}
+
+void ProgramGenerator::cond(unsigned Depth)
+{
+  if (Depth == 0 || below(2))
+  {
+    expr(Depth);
+    Out += ' ';
+    Out += CmpOps[below(sizeof(CmpOps) / sizeof(CmpOps[0]))];
+    Out += ' ';
+    expr(Depth);
+    return;
+  }
+  Out += '(';
+  cond(Depth - 1);
+  Out += ") ";
+  Out += BoolOps[below(2)];
+  Out += " (";
+  cond(Depth - 1);
+  Out += ')';
+}
+
+void ProgramGenerator::assign(unsigned Depth)
+{
+  static const char *const AssignOps[] = {" = ", " += ", " -= ", " *= "};
+  var();
+  Out += AssignOps[below(4)];
+  expr(Depth);
+  Out += ";\n";
+}
+
+void ProgramGenerator::statement(Shape S)
+{
+  switch (S)
+  {
+  case Decls: {
+    unsigned N = 1 + below(6);
+    unsigned Inits = below(N + 1);
+    Out += "int ";
+    for (unsigned I = 0; I != N; ++I)
+    {
+      if (I)
+        Out += ", ";
+      // identifiers are letters only: 'v' followed by NextVar in base 26
+      Out += 'v';
+      for (unsigned N = NextVar++; N; N /= 26)
+        Out += char('a' + N % 26);
+    }
+    if (Inits)
+    {
+      Out += " = ";
+      for (unsigned I = 0; I != Inits; ++I)
+      {
+        if (I)
+          Out += ", ";
+        Out += std::to_string(below(1000));
+      }
+    }
+    Out += ";\n";
+    break;
+  }
+  case Exprs:
+    assign(16 + below(32));
+    break;
+  case IfChains: {
+    unsigned Arms = 8 + below(56);
+    Out += "if ";
+    for (unsigned I = 0; I != Arms; ++I)
+    {
+      if (I)
+        Out += "elif ";
+      var();
+      Out += " == ";
+      Out += std::to_string(I);
+      Out += ": begin\n  ";
+      assign(2);
+      Out += "end\n";
+    }
+    Out += "else: begin\n  ";
+    assign(2);
+    Out += "end\n";
+    break;
+  }
+  case Loops: {
+    Out += "loopc ";
+    cond(1);
+    Out += ": begin\n";
+    for (unsigned I = 0, E = 1 + below(6); I != E; ++I)
+    {
+      Out += "  ";
+      assign(3);
+    }
+    Out += "end\n";
+    break;
+  }
+  case Comments: {
+    Out += "/* ";
+    for (unsigned I = 0, E = 4 + below(60); I != E; ++I)
+      Out += below(8) ? "lorem ipsum " : "a *= 2; b = c / 0; ** ";
+    Out += "*/\n";
+    if (below(2))
+    {
+      Out += "print ";
+      expr(3);
+      Out += ";\n";
+    }
+    else
+      assign(3);
+    break;
+  }
+  }
+}
+
+std::string ProgramGenerator::generate(Shape S, size_t Bytes)
+{
+  Out.clear();
+  Out.reserve(Bytes + 4096);
+  NextVar = 0;
+
+  if (S != Decls)
+  {
+    Out += "int ";
+    for (unsigned I = 0; I != NumVars; ++I)
+    {
+      if (I)
+        Out += ", ";
+      Out += Vars[I];
+    }
+    Out += ";\n";
+  }
+  while (Out.size() < Bytes)
+    statement(S);
+  return std::move(Out);
+}
+
+llvm::StringRef ProgramGenerator::getShapeName(Shape S)
+{
+  switch (S)
+  {
+  case Decls:
+    return "decls";
+  case Exprs:
+    return "exprs";
+  case IfChains:
+    return "if-chains";
+  case Loops:
+    return "loops";
+  case Comments:
+    return "comments";
+  }
+  return "";
+}
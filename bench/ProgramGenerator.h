@@ -0,0 +1,46 @@
+#ifndef PROGRAMGENERATOR_H
+#define PROGRAMGENERATOR_H
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <string>
+
+// ProgramGenerator writes synthetic but valid GSM programs of a requested size.
+// The output only depends on the shape, the size and the seed, so numbers from
+// different builds and machines are measured on the same input.
+class ProgramGenerator
+{
+public:
+  enum Shape
+  {
+    Decls,    // many multi-variable declarations
+    Exprs,    // assignments of deeply nested expressions
+    IfChains, // long if/elif/else chains
+    Loops,    // loops back to back, each with several assignments
+    Comments, // statements interleaved with long block comments
+  };
+
+private:
+  uint64_t State;    // splitmix64 state
+  std::string Out;
+  unsigned NextVar;  // suffix of the next fresh variable in Decls
+
+  uint64_t next();
+  unsigned below(unsigned N) { return unsigned(next() % N); }
+
+  void var();
+  void expr(unsigned Depth); // integer expression
+  void cond(unsigned Depth); // boolean expression
+  void assign(unsigned Depth);
+  void statement(Shape S);
+
+public:
+  explicit ProgramGenerator(uint64_t Seed = 1) : State(Seed), NextVar(0) {}
+
+  // Generate a program of at least Bytes characters.
+  std::string generate(Shape S, size_t Bytes);
+
+  static llvm::StringRef getShapeName(Shape S);
+};
+
+#endif
@@ -0,0 +1,34 @@
+# Run one program with the output functions of rtGSM.ll linked into the module
+# and with those of rtGSM.c, and fail unless both print the same. The program
+# prints 0, negative values, INT_MIN, ten-digit values and more output than
+# the 64 KiB buffer holds. Run with cmake -DGSM=<gsm> -DWORK_DIR=<dir> -P.
+set(Program "int a, i, m = 7, 0, 0;\nm = 0 - 2147483647 - 1;\n")
+string(APPEND Program "print 0; print 0 - 1; print m; print m + 1; print 9; print 10; print 99; print 100;\n")
+string(APPEND Program "print 999999999; print 1000000000; print 2147483647; print 0 - 1000000000;\n")
+# Values the compiler does not fold: the loop leaves a unknown to it.
+string(APPEND Program "loopc i < 100: begin a = a * 31 + 7; i += 1; end\n")
+string(APPEND Program "print a; print a - a; print m + a - a; print 0 - a;\n")
+foreach(N RANGE 3000)
+  string(APPEND Program "a = a * 1103515245 + 12345; print a; print 0 - a;\n")
+endforeach()
+set(Source ${WORK_DIR}/runtimes.gsm)
+file(WRITE ${Source} "${Program}")
+
+foreach(Opt -O0 -O2)
+  foreach(Linked true false)
+    execute_process(COMMAND ${GSM} --run ${Opt} --link-runtime=${Linked} ${Source}
+                    OUTPUT_VARIABLE Output${Linked} RESULT_VARIABLE Status)
+    if(NOT Status EQUAL 0)
+      message(FATAL_ERROR "gsm ${Opt} --link-runtime=${Linked} failed: ${Status}")
+    endif()
+  endforeach()
+  string(LENGTH "${Outputfalse}" Length)
+  if(Length LESS 65536)
+    message(FATAL_ERROR "${Opt}: only ${Length} bytes of output")
+  endif()
+  if(NOT Outputtrue STREQUAL Outputfalse)
+    file(WRITE ${WORK_DIR}/runtimes-linked.out "${Outputtrue}")
+    file(WRITE ${WORK_DIR}/runtimes-c.out "${Outputfalse}")
+    message(FATAL_ERROR "${Opt}: the outputs differ, see ${WORK_DIR}/runtimes-*.out")
+  endif()
+endforeach()
@@ -0,0 +1,5 @@
+# Write the bytes of INPUT to OUTPUT as comma-separated hex literals, to be
+# included into an array initializer. Run with cmake -P.
+file(READ ${INPUT} Hex HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," Bytes "${Hex}")
+file(WRITE ${OUTPUT} "${Bytes}\n")
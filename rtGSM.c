@@ -1,20 +1,99 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Output goes through one large buffer that is written out when it fills up,
+   before reading input and at exit, instead of a printf call per value. On a
+   terminal it is written out after every value as well, so that output shows
+   as it comes and is not lost when a division traps.
+   rtGSM.ll holds the same output functions as LLVM IR for gsm to link into
+   every module; keep the two in step. */
+static char OutBuf[1 << 16];
+static size_t OutLen;
+static int FlushEach;
+
+void gsm_flush(void)
+{
+    fwrite(OutBuf, 1, OutLen, stdout);
+    fflush(stdout);
+    OutLen = 0;
+}
+
+__attribute__((constructor)) static void gsm_check_tty(void)
+{
+    FlushEach = isatty(1);
+}
+
+__attribute__((destructor)) static void gsm_flush_at_exit(void)
+{
+    gsm_flush();
+}
+
+static const char DigitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Append v and a newline, formatting two digits at a time from the end. */
+static void appendInt(int v)
+{
+    char Tmp[12];
+    char *End = Tmp + sizeof(Tmp), *P = End;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    *--P = '\n';
+    while (u >= 100)
+    {
+        unsigned Pair = u % 100 * 2;
+        u /= 100;
+        *--P = DigitPairs[Pair + 1];
+        *--P = DigitPairs[Pair];
+    }
+    if (u >= 10)
+    {
+        *--P = DigitPairs[u * 2 + 1];
+        *--P = DigitPairs[u * 2];
+    }
+    else
+        *--P = (char)('0' + u);
+    if (v < 0)
+        *--P = '-';
+
+    if (OutLen + sizeof(Tmp) > sizeof(OutBuf))
+        gsm_flush();
+    memcpy(OutBuf + OutLen, P, (size_t)(End - P));
+    OutLen += (size_t)(End - P);
+    if (FlushEach)
+        gsm_flush();
+}
 
 void print(int v)
 {
-    printf("%d\n", v);
+    appendInt(v);
+}
+
+/* Consecutive print statements are passed here as one array. */
+void gsm_print_n(const int *v, int n)
+{
+    for (int i = 0; i < n; ++i)
+        appendInt(v[i]);
 }
 
 void loop(int v)
 {
-    printf("The result is: %d\n", v);
+    static const char Prefix[] = "The result is: ";
+    if (OutLen + sizeof(Prefix) > sizeof(OutBuf))
+        gsm_flush();
+    memcpy(OutBuf + OutLen, Prefix, sizeof(Prefix) - 1);
+    OutLen += sizeof(Prefix) - 1;
+    appendInt(v);
 }
 
 int gsm_read(char *s)
 {
     char buf[64];
     int val;
+    gsm_flush();
     printf("Enter a value for %s: ", s);
     fgets(buf, sizeof(buf), stdin);
     if (EOF == sscanf(buf, "%d", &val))
@@ -23,4 +102,4 @@ int gsm_read(char *s)
         exit(1);
     }
     return val;
-}
\ No newline at end of file
+}
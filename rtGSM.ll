@@ -0,0 +1,179 @@
+; The output half of the runtime (see rtGSM.c) as LLVM IR. It is assembled
+; at build time, embedded into gsm and linked into every module before
+; optimisation, so print and gsm_print_n can be inlined into main and
+; specialised for constant arguments. Generated code calls gsm_flush before
+; main returns. There is no C compiler for bitcode in the build, so a change
+; to the output functions has to be made here and in rtGSM.c alike.
+
+@gsm.outbuf = internal global [65536 x i8] zeroinitializer
+@gsm.outlen = internal global i64 0
+@gsm.tty = internal global i32 -1 ; isatty(1) once known
+@gsm.digitpairs = internal constant [200 x i8] c"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899"
+
+declare i64 @write(i32, i8*, i64)
+declare i32 @isatty(i32)
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)
+
+; Rarely called, so kept out of line. The buffer goes straight to file
+; descriptor 1, like the fwrite and fflush in rtGSM.c, again after a partial
+; write and until an error.
+define void @gsm_flush() noinline {
+entry:
+  %len = load i64, i64* @gsm.outlen
+  store i64 0, i64* @gsm.outlen
+  br label %check
+
+check:
+  %written = phi i64 [ 0, %entry ], [ %next, %write ]
+  %left = sub i64 %len, %written
+  %more = icmp sgt i64 %left, 0
+  br i1 %more, label %write, label %done
+
+write:
+  %buf = getelementptr inbounds [65536 x i8], [65536 x i8]* @gsm.outbuf, i64 0, i64 %written
+  %n = call i64 @write(i32 1, i8* %buf, i64 %left)
+  %next = add i64 %written, %n
+  %ok = icmp sgt i64 %n, 0
+  br i1 %ok, label %check, label %done
+
+done:
+  ret void
+}
+
+; Append %v and a newline to the buffer. The digits are formatted into a 12
+; byte scratch buffer, two at a time from the end, without a loop, so that a
+; print inlined into main adds no loop there and folds away for a constant.
+define void @print(i32 %v) {
+entry:
+  %tmp = alloca [12 x i8]
+  %neg = icmp slt i32 %v, 0
+  %negv = sub i32 0, %v
+  %u = select i1 %neg, i32 %negv, i32 %v
+
+  ; All ten digits go to bytes 1 to 10, the newline to byte 11.
+  %nl = getelementptr inbounds [12 x i8], [12 x i8]* %tmp, i64 0, i64 11
+  store i8 10, i8* %nl
+  %pair0 = urem i32 %u, 100
+  %rest0 = udiv i32 %u, 100
+  call void @gsm.copypair(i32 %pair0, [12 x i8]* %tmp, i64 9)
+  %pair1 = urem i32 %rest0, 100
+  %rest1 = udiv i32 %rest0, 100
+  call void @gsm.copypair(i32 %pair1, [12 x i8]* %tmp, i64 7)
+  %pair2 = urem i32 %rest1, 100
+  %rest2 = udiv i32 %rest1, 100
+  call void @gsm.copypair(i32 %pair2, [12 x i8]* %tmp, i64 5)
+  %pair3 = urem i32 %rest2, 100
+  %pair4 = udiv i32 %rest2, 100
+  call void @gsm.copypair(i32 %pair3, [12 x i8]* %tmp, i64 3)
+  call void @gsm.copypair(i32 %pair4, [12 x i8]* %tmp, i64 1)
+
+  ; Skip the leading zeros; a minus sign goes right before the first digit.
+  %ge1 = icmp uge i32 %u, 10
+  %ge2 = icmp uge i32 %u, 100
+  %ge3 = icmp uge i32 %u, 1000
+  %ge4 = icmp uge i32 %u, 10000
+  %ge5 = icmp uge i32 %u, 100000
+  %ge6 = icmp uge i32 %u, 1000000
+  %ge7 = icmp uge i32 %u, 10000000
+  %ge8 = icmp uge i32 %u, 100000000
+  %ge9 = icmp uge i32 %u, 1000000000
+  %n1 = zext i1 %ge1 to i64
+  %n2 = zext i1 %ge2 to i64
+  %n3 = zext i1 %ge3 to i64
+  %n4 = zext i1 %ge4 to i64
+  %n5 = zext i1 %ge5 to i64
+  %n6 = zext i1 %ge6 to i64
+  %n7 = zext i1 %ge7 to i64
+  %n8 = zext i1 %ge8 to i64
+  %n9 = zext i1 %ge9 to i64
+  %s1 = add i64 %n1, %n2
+  %s2 = add i64 %s1, %n3
+  %s3 = add i64 %s2, %n4
+  %s4 = add i64 %s3, %n5
+  %s5 = add i64 %s4, %n6
+  %s6 = add i64 %s5, %n7
+  %s7 = add i64 %s6, %n8
+  %extra = add i64 %s7, %n9
+  %first = sub i64 10, %extra
+  %signpos = sub i64 %first, 1
+  %signp = getelementptr inbounds [12 x i8], [12 x i8]* %tmp, i64 0, i64 %signpos
+  store i8 45, i8* %signp
+  %negbyte = zext i1 %neg to i64
+  %start = sub i64 %first, %negbyte
+  %size = sub i64 12, %start
+
+  %len = load i64, i64* @gsm.outlen
+  %dst = getelementptr inbounds [65536 x i8], [65536 x i8]* @gsm.outbuf, i64 0, i64 %len
+  %src = getelementptr inbounds [12 x i8], [12 x i8]* %tmp, i64 0, i64 %start
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 %size, i1 false)
+  %newlen = add i64 %len, %size
+  call void @gsm.commit(i64 %newlen)
+  ret void
+}
+
+; Store the new length of the buffer and write it out when another value might
+; not fit, so there is always room for one, or when stdout is a terminal, as
+; rtGSM.c does. Kept out of line so that a print inlined into main is a single
+; block: thousands of them in a row would otherwise chain as many branches
+; through main.
+define internal void @gsm.commit(i64 %len) noinline {
+entry:
+  store i64 %len, i64* @gsm.outlen
+  %end = add i64 %len, 12
+  %full = icmp ugt i64 %end, 65536
+  br i1 %full, label %flush, label %tty
+
+tty:
+  %known = load i32, i32* @gsm.tty
+  %unknown = icmp slt i32 %known, 0
+  br i1 %unknown, label %check, label %each
+
+check:
+  %isatty = call i32 @isatty(i32 1)
+  store i32 %isatty, i32* @gsm.tty
+  br label %each
+
+each:
+  %flusheach = phi i32 [ %known, %tty ], [ %isatty, %check ]
+  %onterm = icmp ne i32 %flusheach, 0
+  br i1 %onterm, label %flush, label %done
+
+flush:
+  call void @gsm_flush()
+  br label %done
+
+done:
+  ret void
+}
+
+; Store the two digits of %pair (0 to 99) at %pos in %tmp.
+define internal void @gsm.copypair(i32 %pair, [12 x i8]* %tmp, i64 %pos) alwaysinline {
+entry:
+  %index = shl i32 %pair, 1
+  %index64 = zext i32 %index to i64
+  %src = getelementptr inbounds [200 x i8], [200 x i8]* @gsm.digitpairs, i64 0, i64 %index64
+  %dst = getelementptr inbounds [12 x i8], [12 x i8]* %tmp, i64 0, i64 %pos
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %dst, i8* %src, i64 2, i1 false)
+  ret void
+}
+
+; Consecutive print statements are passed here as one array. Kept out of line
+; so that main does not get a loop for every run of prints.
+define void @gsm_print_n(i32* %v, i32 %n) noinline {
+entry:
+  %any = icmp sgt i32 %n, 0
+  br i1 %any, label %loop, label %done
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i64 = zext i32 %i to i64
+  %p = getelementptr inbounds i32, i32* %v, i64 %i64
+  %value = load i32, i32* %p
+  call void @print(i32 %value)
+  %i.next = add nuw nsw i32 %i, 1
+  %again = icmp slt i32 %i.next, %n
+  br i1 %again, label %loop, label %done
+
+done:
+  ret void
+}
@@ -1,8 +1,10 @@
 #ifndef AST_H
 #define AST_H
 
-#include "llvm/ADT/SmallVector.h"
+#include "ASTContext.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Casting.h"
 
 // Forward declarations of classes used in the AST
 class AST;
@@ -16,60 +18,74 @@ class IfElse;
 class Loop;
 class Print;
 
-// ASTVisitor class defines a visitor pattern to traverse the AST
-class ASTVisitor
+// AST class serves as the base class for all AST nodes.
+// Nodes are allocated in an ASTContext and never deleted individually.
+// Every node records its kind, which drives isa<>/cast<>/dyn_cast<> and the
+// switch in ASTVisitor, so nodes carry no vtable.
+class AST
 {
 public:
-  // Virtual visit functions for each AST node type
-  virtual void visit(AST &) {}               // Visit the base AST node
-  virtual void visit(Expr &) {}              // Visit the expression node
-  virtual void visit(GSM &) = 0;             // Visit the group of expressions node
-  virtual void visit(Factor &) = 0;          // Visit the factor node
-  virtual void visit(BinaryOp &) = 0;        // Visit the binary operation node
-  virtual void visit(Assignment &) = 0;      // Visit the assignment expression node
-  virtual void visit(Declaration &) = 0;     // Visit the variable declaration node
-  virtual void visit(IfElse &) {}     // Visit the variable declaration node
-  virtual void visit(Loop &) {}     // Visit the variable declaration node
-  virtual void visit(Print &) {}     // Visit the variable declaration node
-};
+  enum ASTKind
+  {
+    AK_GSM,
+    AK_Factor,
+    AK_BinaryOp,
+    AK_Assignment,
+    AK_Declaration,
+    AK_IfElse,
+    AK_Loop,
+    AK_Print
+  };
+
+private:
+  const ASTKind Kind;
+
+protected:
+  AST(ASTKind Kind) : Kind(Kind) {}
 
-// AST class serves as the base class for all AST nodes
-class AST
-{
 public:
-  virtual ~AST() {}
-  virtual void accept(ASTVisitor &V) = 0;    // Accept a visitor for traversal
+  ASTKind getKind() const { return Kind; }
+
+  // Accept a visitor for traversal (see ASTVisitor below)
+  template <typename VisitorT>
+  void accept(VisitorT &V) { V.dispatch(*this); }
 };
 
 // Expr class represents an expression in the AST
 class Expr : public AST
 {
+  bool Shared = false; // used by more than one parent, see Parser::setHashConsing
+
+protected:
+  Expr(ASTKind Kind) : AST(Kind) {}
+
 public:
-  Expr() {}
+  static bool classof(const AST *N) { return N->getKind() >= AK_GSM && N->getKind() <= AK_Print; }
+
+  bool isShared() const { return Shared; }
+  void setShared() { Shared = true; }
 };
 
 
 // GSM class represents a group of expressions in the AST
 class GSM : public Expr
 {
-  using ExprVector = llvm::SmallVector<Expr *>;
+  using ExprVector = llvm::ArrayRef<Expr *>;
 
 private:
   ExprVector exprs;                          // Stores the list of expressions
 
 public:
-  GSM(llvm::SmallVector<Expr *> exprs) : exprs(exprs) {}
+  GSM(llvm::ArrayRef<Expr *> exprs) : Expr(AK_GSM), exprs(exprs) {}
 
-  llvm::SmallVector<Expr *> getExprs() { return exprs; }
+  static bool classof(const AST *N) { return N->getKind() == AK_GSM; }
+
+  llvm::ArrayRef<Expr *> getExprs() { return exprs; }
 
   ExprVector::const_iterator begin() { return exprs.begin(); }
 
   ExprVector::const_iterator end() { return exprs.end(); }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 // Factor class represents a factor in the AST (either an identifier or a number)
@@ -84,19 +100,20 @@ public:
 
 private:
   ValueKind Kind;                            // Stores the kind of factor (identifier or number)
+  uint32_t Sym;                              // Symbol id of an identifier
   llvm::StringRef Val;                       // Stores the value of the factor
 
 public:
-  Factor(ValueKind Kind, llvm::StringRef Val) : Kind(Kind), Val(Val) {}
+  Factor(ValueKind Kind, llvm::StringRef Val, uint32_t Sym = 0) : Expr(AK_Factor), Kind(Kind), Sym(Sym), Val(Val) {}
+
+  static bool classof(const AST *N) { return N->getKind() == AK_Factor; }
 
-  ValueKind getKind() { return Kind; }
+  ValueKind getValueKind() { return Kind; }
 
   llvm::StringRef getVal() { return Val; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  uint32_t getSymbol() { return Sym; }
+
 };
 
 // BinaryOp class represents a binary operation in the AST (plus, minus, multiplication, division and etc)
@@ -127,7 +144,9 @@ private:
   Operator Op;                              // Operator of the binary operation
 
 public:
-  BinaryOp(Operator Op, Expr *L, Expr *R) : Op(Op), Left(L), Right(R) {}
+  BinaryOp(Operator Op, Expr *L, Expr *R) : Expr(AK_BinaryOp), Left(L), Right(R), Op(Op) {}
+
+  static bool classof(const AST *N) { return N->getKind() == AK_BinaryOp; }
 
   Expr *getLeft() { return Left; }
 
@@ -135,10 +154,6 @@ public:
 
   Operator getOperator() { return Op; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 // Assignment class represents an assignment expression in the AST
@@ -157,47 +172,36 @@ public:
 
 private:
   Factor *Left;                             // Left-hand side factor (identifier)
-  Expr *Right;                              // Right-hand side expression
-  Type type;                              // Right-hand side expression
+  Expr *Right;                              // Value stored, compound assignments already expanded
+  Type type;                                // Kind of assignment as written in the source
 
 public:
 
-  Assignment(Factor *L, Expr *R, Type T) : Left(L), Right(R), type(T) {}
+  // For compound assignments R is the expanded expression, e.g. a + b for a += b.
+  Assignment(Factor *L, Expr *R, Type T) : Expr(AK_Assignment), Left(L), Right(R), type(T) {}
+
+  static bool classof(const AST *N) { return N->getKind() == AK_Assignment; }
 
   Factor *getLeft() { return Left; }
 
-  Expr *getRight() { 
-    if (type == Type::Equal)
-      return Right;
-    else if (type == EqualPlus) 
-      return new BinaryOp(BinaryOp::Operator::Plus, Left, Right);
-    else if (type == EqualMinus) 
-      return new BinaryOp(BinaryOp::Operator::Minus, Left, Right);
-    else if (type == EqualMod) 
-      return new BinaryOp(BinaryOp::Operator::Mod, Left, Right);
-    else if (type == EqualSlash) 
-      return new BinaryOp(BinaryOp::Operator::Div, Left, Right);
-    else if (type == EqualStar) 
-      return new BinaryOp(BinaryOp::Operator::Mul, Left, Right);
-    return Right;
-  }
+  Expr *getRight() { return Right; }
+
+  Type getType() { return type; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 // Declaration class represents a variable declaration with an initializer in the AST
 class Declaration : public Expr
 {
-  using VarVector = llvm::SmallVector<llvm::StringRef, 8>;
-  using ExprVector = llvm::SmallVector<Expr *, 8>;
-  VarVector Vars;                           // Stores the list of variables
+  using VarVector = llvm::ArrayRef<uint32_t>;
+  using ExprVector = llvm::ArrayRef<Expr *>;
+  VarVector Vars;                           // Stores the symbol ids of the variables
   ExprVector Exprs;       // Expression serving as the initializer
 
 public:
-  Declaration(llvm::SmallVector<llvm::StringRef, 8> Vars, llvm::SmallVector<Expr *, 8> Expr) : Vars(Vars), Exprs(Expr) {}
+  Declaration(llvm::ArrayRef<uint32_t> Vars, llvm::ArrayRef<Expr *> Expr) : ::Expr(AK_Declaration), Vars(Vars), Exprs(Expr) {}
+
+  static bool classof(const AST *N) { return N->getKind() == AK_Declaration; }
 
   VarVector::const_iterator begin_vars() { return Vars.begin(); }
 
@@ -207,49 +211,53 @@ public:
 
   ExprVector::const_iterator end_exprs() { return Exprs.end(); }
 
-  llvm::SmallVector<Expr *, 8> getExprs() { return Exprs; }
+  llvm::ArrayRef<Expr *> getExprs() { return Exprs; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 };
 
 class IfElse : public Expr
 {
 private:
-  llvm::SmallVector<Expr *> conditions;
-  llvm::SmallVector<llvm::SmallVector<Assignment *>> assignments;
+  llvm::ArrayRef<Expr *> conditions;
+  llvm::ArrayRef<llvm::ArrayRef<Assignment *>> assignments;
 
 public:
-  IfElse(llvm::SmallVector<Expr *> c, llvm::SmallVector<llvm::SmallVector<Assignment *>> a) : conditions(c), assignments(a) {}
+  IfElse(llvm::ArrayRef<Expr *> c, llvm::ArrayRef<llvm::ArrayRef<Assignment *>> a) : Expr(AK_IfElse), conditions(c), assignments(a) {}
 
-  llvm::SmallVector<llvm::SmallVector<Assignment *>> getAssignments() { return assignments; }
-  llvm::SmallVector<Expr *> getConditions() { return conditions; }
+  static bool classof(const AST *N) { return N->getKind() == AK_IfElse; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
+  llvm::ArrayRef<llvm::ArrayRef<Assignment *>> getAssignments() { return assignments; }
+  llvm::ArrayRef<Expr *> getConditions() { return conditions; }
+
+};
+
+// Optimisation hints written after a loop condition, e.g. `loopc i < n unroll 4:`.
+// Zero means no hint.
+struct LoopHints
+{
+  unsigned Unroll = 0;    // unroll count; 1 disables unrolling
+  unsigned Vectorize = 0; // vectorization width; 1 disables vectorization
 };
 
 class Loop : public Expr
 {
 private:
   Expr *Condition;
-  llvm::SmallVector<Assignment *> assignments;
+  llvm::ArrayRef<Assignment *> assignments;
+  LoopHints Hints;
 
 public:
-  Loop(Expr *c, llvm::SmallVector<Assignment *> a) : Condition(c), assignments(a) {}
+  Loop(Expr *c, llvm::ArrayRef<Assignment *> a, LoopHints h = LoopHints())
+      : Expr(AK_Loop), Condition(c), assignments(a), Hints(h) {}
+
+  static bool classof(const AST *N) { return N->getKind() == AK_Loop; }
 
-  virtual void accept(ASTVisitor &V) override
-  {
-    V.visit(*this);
-  }
 
   Expr *getCondition() { return Condition; }
 
-  llvm::SmallVector<Assignment *> getAssignments() { return assignments; }
+  llvm::ArrayRef<Assignment *> getAssignments() { return assignments; }
+
+  const LoopHints &getHints() const { return Hints; }
 };
 
 class Print : public Expr
@@ -258,14 +266,55 @@ private:
   Expr *E;
 
 public:
-  Print(Expr *e) : E(e) {}
+  Print(Expr *e) : Expr(AK_Print), E(e) {}
 
-  virtual void accept(ASTVisitor &V) override
+  static bool classof(const AST *N) { return N->getKind() == AK_Print; }
+
+
+  Expr *getExpr() { return E; }
+};
+
+// ASTVisitor class defines a visitor pattern to traverse the AST. Derived classes
+// inherit from ASTVisitor<Derived> and provide visit() for the nodes they handle;
+// dispatch() selects the overload with a switch on the node kind, so the calls
+// are direct and can be inlined. A visitor that skips some node kinds pulls the
+// empty defaults in with "using ASTVisitor<Derived>::visit;".
+template <typename Derived>
+class ASTVisitor
+{
+public:
+  void dispatch(AST &Node)
   {
-    V.visit(*this);
+    Derived &D = static_cast<Derived &>(*this);
+    switch (Node.getKind())
+    {
+    case AST::AK_GSM:
+      return D.visit(llvm::cast<GSM>(Node));
+    case AST::AK_Factor:
+      return D.visit(llvm::cast<Factor>(Node));
+    case AST::AK_BinaryOp:
+      return D.visit(llvm::cast<BinaryOp>(Node));
+    case AST::AK_Assignment:
+      return D.visit(llvm::cast<Assignment>(Node));
+    case AST::AK_Declaration:
+      return D.visit(llvm::cast<Declaration>(Node));
+    case AST::AK_IfElse:
+      return D.visit(llvm::cast<IfElse>(Node));
+    case AST::AK_Loop:
+      return D.visit(llvm::cast<Loop>(Node));
+    case AST::AK_Print:
+      return D.visit(llvm::cast<Print>(Node));
+    }
   }
 
-  Expr *getExpr() { return E; }
+  void visit(GSM &) {}
+  void visit(Factor &) {}
+  void visit(BinaryOp &) {}
+  void visit(Assignment &) {}
+  void visit(Declaration &) {}
+  void visit(IfElse &) {}
+  void visit(Loop &) {}
+  void visit(Print &) {}
 };
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef ASTCONTEXT_H
+#define ASTCONTEXT_H
+
+#include "SymbolTable.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include <memory>
+
+// ASTContext owns the memory of all AST nodes and the lists they refer to.
+// Everything is bump-allocated and released at once when the context is destroyed,
+// so node destructors are never run. It also holds the identifiers interned by the
+// parser, which stay valid after the nodes are released.
+class ASTContext
+{
+  llvm::BumpPtrAllocator Allocator;
+  SymbolTable Symbols;
+
+public:
+  SymbolTable &getSymbols() { return Symbols; }
+
+  void *allocate(size_t Size, size_t Alignment) { return Allocator.Allocate(Size, llvm::Align(Alignment)); }
+
+  // Copy a list built during parsing into the arena.
+  template <typename T>
+  llvm::ArrayRef<T> copy(llvm::ArrayRef<T> Elts)
+  {
+    if (Elts.empty())
+      return llvm::ArrayRef<T>();
+    T *Mem = Allocator.Allocate<T>(Elts.size());
+    std::uninitialized_copy(Elts.begin(), Elts.end(), Mem);
+    return llvm::ArrayRef<T>(Mem, Elts.size());
+  }
+
+  // Copy text that is not part of the input buffer, e.g. a folded literal.
+  llvm::StringRef copy(llvm::StringRef Str)
+  {
+    llvm::ArrayRef<char> Chars = copy(llvm::ArrayRef<char>(Str.data(), Str.size()));
+    return llvm::StringRef(Chars.data(), Chars.size());
+  }
+
+  // Free every node at once; all pointers into the context become invalid.
+  void reset() { Allocator.Reset(); }
+
+  size_t getBytesAllocated() const { return Allocator.getBytesAllocated(); }
+};
+
+// Placement new for AST nodes, e.g. new (Ctx) Factor(Factor::Number, "1").
+inline void *operator new(size_t Bytes, ASTContext &C, size_t Alignment = alignof(std::max_align_t))
+{
+  return C.allocate(Bytes, Alignment);
+}
+
+// Only called if a node constructor throws; the arena reclaims the memory anyway.
+inline void operator delete(void *, ASTContext &, size_t) {}
+
+#endif
@@ -0,0 +1,151 @@
+#include "Backend.h"
+#include "Timing.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+bool Backend::initTarget(unsigned OptLevel)
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  std::string Triple = sys::getDefaultTargetTriple();
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+  if (!T)
+  {
+    errs() << "Could not find target " << Triple << ": " << Error << "\n";
+    return true;
+  }
+
+  CodeGenOpt::Level Level = CodeGenOpt::None;
+  if (OptLevel == 1)
+    Level = CodeGenOpt::Less;
+  else if (OptLevel == 2)
+    Level = CodeGenOpt::Default;
+  else if (OptLevel >= 3)
+    Level = CodeGenOpt::Aggressive;
+
+  // Objects are linked into position independent executables by default.
+  TargetOptions Options;
+  TM.reset(T->createTargetMachine(Triple, "generic", "", Options, Reloc::PIC_,
+                                  None, Level));
+  return false;
+}
+
+Backend::EmitKind Backend::kindForOutput(StringRef Output)
+{
+  StringRef Ext = sys::path::extension(Output);
+  if (Output == "-" || Ext == ".ll")
+    return LL;
+  if (Ext == ".bc")
+    return BC;
+  if (Ext == ".s")
+    return Asm;
+  if (Ext == ".o")
+    return Obj;
+  return Exe;
+}
+
+bool Backend::emit(Module &M, EmitKind Kind, StringRef Output)
+{
+  PhaseTimer Timer("emit", "Emission");
+  if (Kind == Asm || Kind == Obj || Kind == Exe)
+  {
+    if (!TM && initTarget(0))
+      return true;
+    M.setTargetTriple(TM->getTargetTriple().str());
+    M.setDataLayout(TM->createDataLayout());
+  }
+
+  if (Kind == Asm)
+    return emitObject(M, CGFT_AssemblyFile, Output);
+  if (Kind == Obj)
+    return emitObject(M, CGFT_ObjectFile, Output);
+
+  if (Kind == Exe)
+  {
+    // The driver would take "-" as a file name and leave an executable named so.
+    if (Output == "-")
+    {
+      errs() << "An executable cannot be written to stdout, name it with -o\n";
+      return true;
+    }
+    // Emit into a temporary object and let the system compiler driver link it.
+    SmallString<128> Object;
+    if (std::error_code EC = sys::fs::createTemporaryFile("gsm", "o", Object))
+    {
+      errs() << "Could not create temporary object: " << EC.message() << "\n";
+      return true;
+    }
+    bool Failed = emitObject(M, CGFT_ObjectFile, Object) || link(Object, Output);
+    sys::fs::remove(Object);
+    return Failed;
+  }
+
+  std::error_code EC;
+  ToolOutputFile Out(Output, EC, Kind == LL ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC)
+  {
+    errs() << "Could not open " << Output << ": " << EC.message() << "\n";
+    return true;
+  }
+  if (Kind == BC)
+    WriteBitcodeToFile(M, Out.os());
+  else
+    M.print(Out.os(), nullptr);
+  Out.keep();
+  return false;
+}
+
+bool Backend::emitObject(Module &M, CodeGenFileType FileType, StringRef Output)
+{
+  std::error_code EC;
+  ToolOutputFile Out(Output, EC,
+                     FileType == CGFT_AssemblyFile ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC)
+  {
+    errs() << "Could not open " << Output << ": " << EC.message() << "\n";
+    return true;
+  }
+
+  legacy::PassManager PM;
+  if (TM->addPassesToEmitFile(PM, Out.os(), nullptr, FileType))
+  {
+    errs() << "The target cannot emit this file type\n";
+    return true;
+  }
+  PM.run(M);
+  Out.keep();
+  return false;
+}
+
+bool Backend::link(StringRef Object, StringRef Output)
+{
+  PhaseTimer Timer("link", "Linking");
+  ErrorOr<std::string> CC = sys::findProgramByName("cc");
+  if (!CC)
+  {
+    errs() << "Could not find a system compiler to link with: "
+           << CC.getError().message() << "\n";
+    return true;
+  }
+
+  StringRef Args[] = {*CC, "-o", Output, Object, Runtime};
+  std::string ErrMsg;
+  if (sys::ExecuteAndWait(*CC, Args, None, {}, 0, 0, &ErrMsg))
+  {
+    errs() << "Linking failed" << (ErrMsg.empty() ? "" : ": ") << ErrMsg << "\n";
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,43 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+class Backend
+{
+public:
+  enum EmitKind
+  {
+    LL,  // textual IR
+    BC,  // bitcode
+    Asm, // target assembly
+    Obj, // object file
+    Exe  // object file linked with the runtime by the system compiler driver
+  };
+
+private:
+  std::unique_ptr<llvm::TargetMachine> TM;
+  std::string Runtime; // runtime linked into executables
+
+  bool emitObject(llvm::Module &M, llvm::CodeGenFileType FileType, llvm::StringRef Output);
+  bool link(llvm::StringRef Object, llvm::StringRef Output);
+
+public:
+  Backend(llvm::StringRef Runtime) : Runtime(Runtime.str()) {}
+
+  // Create the host target machine, generating code at the given -O level.
+  // Returns true if no target is available.
+  bool initTarget(unsigned OptLevel);
+
+  llvm::TargetMachine *getTargetMachine() { return TM.get(); }
+
+  // Write the module to Output ("-" is stdout, except for an executable) in
+  // the given form. Returns true if an error occurred.
+  bool emit(llvm::Module &M, EmitKind Kind, llvm::StringRef Output);
+
+  // Guess what to emit from the extension of the output file.
+  static EmitKind kindForOutput(llvm::StringRef Output);
+};
+#endif
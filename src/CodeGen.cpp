@@ -1,15 +1,45 @@
 #include "CodeGen.h"
+#include "Runtime.h"
+#include "SSABuilder.h"
+#include "Timing.h"
+#include "ValueRange.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/IPO/Internalize.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "codegen"
+
+ALWAYS_ENABLED_STATISTIC(NumBlocks, "Number of basic blocks emitted");
+ALWAYS_ENABLED_STATISTIC(NumInsts, "Number of IR instructions emitted");
+ALWAYS_ENABLED_STATISTIC(NumAllocas, "Number of allocas emitted");
+ALWAYS_ENABLED_STATISTIC(NumPowChains, "Number of ^ unrolled for a constant exponent");
+ALWAYS_ENABLED_STATISTIC(NumPowCalls, "Number of ^ lowered to a gsm_ipow call");
+ALWAYS_ENABLED_STATISTIC(NumSwitches, "Number of if chains lowered to a switch");
+ALWAYS_ENABLED_STATISTIC(NumUnsignedDivs, "Number of / and % emitted unsigned for non-negative operands");
+ALWAYS_ENABLED_STATISTIC(NumDivShifts, "Number of unsigned / and % by a power of two emitted as a shift or mask");
+ALWAYS_ENABLED_STATISTIC(NumNUWFlags, "Number of +, - and * marked nuw");
+ALWAYS_ENABLED_STATISTIC(NumRangeLoads, "Number of variable loads with !range metadata");
+ALWAYS_ENABLED_STATISTIC(NumPrintBatches, "Number of print runs emitted as one gsm_print_n call");
+ALWAYS_ENABLED_STATISTIC(NumReusedValues, "Number of shared expressions whose value was reused");
+ALWAYS_ENABLED_STATISTIC(NumOptBlocks, "Number of basic blocks after optimisation");
+ALWAYS_ENABLED_STATISTIC(NumOptInsts, "Number of IR instructions after optimisation");
+
 // Define a visitor class for generating LLVM IR from the AST.
 namespace
 {
-  class ToIRVisitor : public ASTVisitor
+  class ToIRVisitor : public ASTVisitor<ToIRVisitor>
   {
     Module *M;
     IRBuilder<> Builder;
@@ -20,18 +50,309 @@ namespace
     Constant *Int32Zero;
 
     Value *V;
+    ValueRange VRange; // range of V
     Value *tmp1;
     Value *tmp2;
-    StringMap<AllocaInst *> nameMap;
+    std::vector<AllocaInst *> Vars; // storage of each variable, indexed by symbol id
+    bool UseSSA;                    // build SSA values instead of allocas
+    std::unique_ptr<SSABuilder> SSA;
+
+    std::vector<Value *> FlatValues;   // value of each FlatAST node emitted so far
+    std::vector<ValueRange> FlatRanges; // and its range
+
+    RangeAnalysis Ranges; // ranges of the variables at the insert point
+    bool HasError = false;
+
+    // Plain counters for --stats, added to the statistics once in countStats.
+    struct
+    {
+      unsigned PowChains = 0, PowCalls = 0, Switches = 0;
+      unsigned UnsignedDivs = 0, DivShifts = 0, NUWFlags = 0, RangeLoads = 0;
+      unsigned PrintBatches = 0, ReusedValues = 0;
+    } Counts;
+
+    // Values of shared (hash-consed) expression nodes. Only values from the
+    // current block are kept, as a value from another block need not dominate
+    // the use, and an entry is dropped when a variable it reads is written.
+    struct SharedValue
+    {
+      WeakTrackingVH Val;           // follows phis replaced by the SSA builder
+      ValueRange Range;
+      unsigned DepsBegin, DepsEnd;  // symbols read, a range of SharedDeps
+    };
+    DenseMap<Expr *, SharedValue> SharedValues;
+    DenseMap<uint32_t, SmallVector<Expr *, 4>> SharedReaders; // entries by symbol read
+    SmallVector<uint32_t, 0> SharedDeps;
+    BasicBlock *SharedBB = nullptr;
+    SmallVector<uint32_t, 16> Reads; // symbols read by the current statement
 
     Function *MainFn;
 
     FunctionType *CalcWriteFnTy;
     Function *CalcWriteFn;
 
+    Function *PowFn = nullptr; // gsm_ipow, created on first use
+
+    // Up to PrintBatch consecutive print statements go to the runtime in one
+    // gsm_print_n call, through a buffer in main's frame.
+    static constexpr unsigned PrintBatch = 64;
+    Function *PrintNFn = nullptr;
+    AllocaInst *PrintBuf = nullptr;
+
+    // Create gsm_ipow(base, exp), computing base ^ exp by repeated squaring in
+    // SSA form. Like every ^ in GSM, exponents <= 0 give 1 and products wrap.
+    Function *getPowFn()
+    {
+      if (PowFn)
+        return PowFn;
+      LLVMContext &Ctx = M->getContext();
+      FunctionType *PowTy = FunctionType::get(Int32Ty, {Int32Ty, Int32Ty}, false);
+      PowFn = Function::Create(PowTy, GlobalValue::InternalLinkage, "gsm_ipow", M);
+      PowFn->addFnAttr(Attribute::NoUnwind);
+      PowFn->addFnAttr(Attribute::ReadNone);
+      PowFn->addFnAttr(Attribute::WillReturn);
+      Value *Base = PowFn->getArg(0);
+      Value *Exp = PowFn->getArg(1);
+      Base->setName("base");
+      Exp->setName("exp");
+
+      BasicBlock *EntryBB = BasicBlock::Create(Ctx, "entry", PowFn);
+      BasicBlock *LoopBB = BasicBlock::Create(Ctx, "loop", PowFn);
+      BasicBlock *DoneBB = BasicBlock::Create(Ctx, "done", PowFn);
+      IRBuilder<> B(EntryBB);
+      B.CreateCondBr(B.CreateICmpSGT(Exp, Int32Zero), LoopBB, DoneBB);
+
+      // Multiply the square of the base into the result for every set bit.
+      B.SetInsertPoint(LoopBB);
+      PHINode *Result = B.CreatePHI(Int32Ty, 2, "result");
+      PHINode *Square = B.CreatePHI(Int32Ty, 2, "square");
+      PHINode *Bits = B.CreatePHI(Int32Ty, 2, "bits");
+      Value *Odd = B.CreateTrunc(Bits, B.getInt1Ty());
+      Value *NextResult = B.CreateSelect(Odd, B.CreateMul(Result, Square), Result);
+      Value *NextSquare = B.CreateMul(Square, Square);
+      Value *NextBits = B.CreateLShr(Bits, 1);
+      B.CreateCondBr(B.CreateICmpNE(NextBits, Int32Zero), LoopBB, DoneBB);
+      Result->addIncoming(B.getInt32(1), EntryBB);
+      Result->addIncoming(NextResult, LoopBB);
+      Square->addIncoming(Base, EntryBB);
+      Square->addIncoming(NextSquare, LoopBB);
+      Bits->addIncoming(Exp, EntryBB);
+      Bits->addIncoming(NextBits, LoopBB);
+
+      B.SetInsertPoint(DoneBB);
+      PHINode *Pow = B.CreatePHI(Int32Ty, 2);
+      Pow->addIncoming(B.getInt32(1), EntryBB);
+      Pow->addIncoming(NextResult, LoopBB);
+      B.CreateRet(Pow);
+      return PowFn;
+    }
+
+    // A constant exponent is unrolled into a square-and-multiply chain over its
+    // bits, about 2 * log2(Exp) multiplies; anything else calls gsm_ipow.
+    Value *emitPower(Value *Base, Value *Exp)
+    {
+      auto *C = dyn_cast<ConstantInt>(Exp);
+      if (!C)
+      {
+        ++Counts.PowCalls;
+        return Builder.CreateCall(getPowFn(), {Base, Exp});
+      }
+      ++Counts.PowChains;
+      int64_t N = C->getSExtValue();
+      if (N <= 0)
+        return Builder.getInt32(1);
+      Value *Result = Base;
+      for (int Bit = Log2_64(N) - 1; Bit >= 0; --Bit)
+      {
+        Result = Builder.CreateMul(Result, Result);
+        if ((N >> Bit) & 1)
+          Result = Builder.CreateMul(Result, Base);
+      }
+      return Result;
+    }
+
+    // Store the values of a run of prints and hand them to the runtime at once.
+    // The values are all computed before any is printed, which countPrints
+    // keeps unobservable.
+    void emitPrints(unsigned Count, function_ref<Value *(unsigned I)> EmitValue)
+    {
+      ++Counts.PrintBatches;
+      if (!PrintNFn)
+      {
+        FunctionType *PrintNTy = FunctionType::get(VoidTy, {Int32Ty->getPointerTo(), Int32Ty}, false);
+        PrintNFn = Function::Create(PrintNTy, GlobalValue::ExternalLinkage, "gsm_print_n", M);
+        BasicBlock &Entry = MainFn->getEntryBlock();
+        PrintBuf = IRBuilder<>(&Entry, Entry.begin())
+                       .CreateAlloca(ArrayType::get(Int32Ty, PrintBatch), nullptr, "print.buf");
+      }
+      Type *BufTy = PrintBuf->getAllocatedType();
+      for (unsigned I = 0; I != Count; ++I)
+        Builder.CreateStore(toInt(EmitValue(I)), Builder.CreateConstInBoundsGEP2_32(BufTy, PrintBuf, 0, I));
+      Builder.CreateCall(PrintNFn, {Builder.CreateConstInBoundsGEP2_32(BufTy, PrintBuf, 0, 0),
+                                    Builder.getInt32(Count)});
+    }
+
+    // The number of print statements starting at Stmts[Begin], at most PrintBatch.
+    // A / or % that may trap would do so before the earlier prints of its run
+    // are written, so a print that may trap can only start a run. No variable
+    // changes within a run, so the ranges at its start hold for all of it.
+    template <typename T, typename IsPrintFn, typename MayTrapFn>
+    static unsigned countPrints(ArrayRef<T> Stmts, size_t Begin, IsPrintFn IsPrint, MayTrapFn MayTrap)
+    {
+      unsigned Count = 0;
+      while (Begin + Count != Stmts.size() && Count != PrintBatch && IsPrint(Stmts[Begin + Count]) &&
+             (Count == 0 || !MayTrap(Stmts[Begin + Count])))
+        ++Count;
+      return Count;
+    }
+
+    // Comparisons and and/or produce i1, everything else i32. A value is converted
+    // where the other type is expected: booleans widen to 0 or 1, integers test
+    // against zero.
+    Value *toInt(Value *Val)
+    {
+      return Val->getType() == Int32Ty ? Val : Builder.CreateZExt(Val, Int32Ty);
+    }
+
+    Value *toBool(Value *Val)
+    {
+      return Val->getType()->isIntegerTy(1) ? Val : Builder.CreateICmpNE(Val, Int32Zero);
+    }
+
+    static bool isLogical(BinaryOp::Operator Op)
+    {
+      return Op == BinaryOp::And || Op == BinaryOp::Or;
+    }
+
+    // Blocks of a short-circuit and/or whose right operand is being emitted.
+    struct LogicalBlocks
+    {
+      BasicBlock *FromBB;            // block that decided on the left operand alone
+      BasicBlock *EndBB;             // join block
+      RangeAnalysis::Mark RangeMark; // ranges before the left operand was assumed
+    };
+
+    // Branch on the left operand of and/or and continue in the block that
+    // evaluates the right one. That block only runs when the left operand holds
+    // for and, and when it fails for or; AssumeLeft narrows the ranges to it.
+    LogicalBlocks beginLogical(BinaryOp::Operator Op, Value *Left, function_ref<void(bool Holds)> AssumeLeft)
+    {
+      bool IsAnd = Op == BinaryOp::And;
+      Value *Cond = toBool(Left);
+      LogicalBlocks Blocks{Builder.GetInsertBlock(),
+                           BasicBlock::Create(M->getContext(), IsAnd ? "and.end" : "or.end", MainFn),
+                           Ranges.mark()};
+      AssumeLeft(IsAnd);
+      BasicBlock *RHSBB = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", MainFn, Blocks.EndBB);
+      if (IsAnd)
+        Builder.CreateCondBr(Cond, RHSBB, Blocks.EndBB);
+      else
+        Builder.CreateCondBr(Cond, Blocks.EndBB, RHSBB);
+      Builder.SetInsertPoint(RHSBB);
+      return Blocks;
+    }
+
+    // Join the short-circuit edge with the value of the right operand.
+    Value *endLogical(BinaryOp::Operator Op, LogicalBlocks Blocks, Value *Right)
+    {
+      Right = toBool(Right);
+      Ranges.rollback(Blocks.RangeMark);
+      BasicBlock *RHSEndBB = Builder.GetInsertBlock();
+      Builder.CreateBr(Blocks.EndBB);
+      Builder.SetInsertPoint(Blocks.EndBB);
+      PHINode *Phi = Builder.CreatePHI(Builder.getInt1Ty(), 2);
+      Phi->addIncoming(Builder.getInt1(Op == BinaryOp::Or), Blocks.FromBB);
+      Phi->addIncoming(Right, RHSEndBB);
+      return Phi;
+    }
+
+    // / and % of a non-negative value by a positive one give the same result
+    // signed and unsigned, and unsigned ones by a power of two are a shift or
+    // a mask. A divisor that is always zero is an error only where the
+    // division can run.
+    Value *emitDivision(BinaryOp::Operator Op, Value *Left, ValueRange LR, Value *Right, ValueRange RR)
+    {
+      bool IsDiv = Op == BinaryOp::Div;
+      if (RR.isConstant(0) && !Ranges.isUnreachable())
+      {
+        errs() << "Division by zero is not allowed." << "\n";
+        HasError = true;
+      }
+      if (!LR.isNonNegative() || !RR.isPositive())
+        return IsDiv ? Builder.CreateSDiv(Left, Right) : Builder.CreateSRem(Left, Right);
+      ++Counts.UnsignedDivs;
+      auto *C = dyn_cast<ConstantInt>(Right);
+      if (C && C->getValue().isPowerOf2())
+      {
+        ++Counts.DivShifts;
+        return IsDiv ? Builder.CreateLShr(Left, C->getValue().logBase2())
+                     : Builder.CreateAnd(Left, C->getValue() - 1);
+      }
+      return IsDiv ? Builder.CreateUDiv(Left, Right) : Builder.CreateURem(Left, Right);
+    }
+
+    // Emit the instructions for a binary operator applied to already computed
+    // operands with the ranges LR and RR.
+    Value *emitBinary(BinaryOp::Operator Op, Value *Left, ValueRange LR, Value *Right, ValueRange RR)
+    {
+      Left = toInt(Left);
+      Right = toInt(Right);
+
+      // Without signed wrap, non-negative operands of + and * cannot wrap
+      // unsigned either, and neither can a - that stays non-negative.
+      bool NUW = Op == BinaryOp::Minus ? RR.isNonNegative() && LR.Lo >= RR.Hi
+                                       : LR.isNonNegative() && RR.isNonNegative();
+      if (NUW && (Op == BinaryOp::Plus || Op == BinaryOp::Minus || Op == BinaryOp::Mul))
+        ++Counts.NUWFlags;
+
+      // Perform the binary operation based on the operator type and create the corresponding instruction.
+      Value *V = nullptr;
+      switch (Op)
+      {
+      case BinaryOp::Plus:
+        V = Builder.CreateAdd(Left, Right, "", NUW, /*HasNSW=*/true);
+        break;
+      case BinaryOp::Minus:
+        V = Builder.CreateSub(Left, Right, "", NUW, /*HasNSW=*/true);
+        break;
+      case BinaryOp::Mul:
+        V = Builder.CreateMul(Left, Right, "", NUW, /*HasNSW=*/true);
+        break;
+      case BinaryOp::Div:
+      case BinaryOp::Mod:
+        V = emitDivision(Op, Left, LR, Right, RR);
+        break;
+      case BinaryOp::Power:
+        V = emitPower(Left, Right);
+        break;
+      case BinaryOp::Or:
+      case BinaryOp::And:
+        llvm_unreachable("and/or are lowered with branches");
+      case BinaryOp::DoubleEqual:
+        V = Builder.CreateICmpEQ(Left, Right);
+        break;
+      case BinaryOp::NotEqual:
+        V = Builder.CreateICmpNE(Left, Right);
+        break;
+      case BinaryOp::GreaterEqual:
+        V = Builder.CreateICmpSGE(Left, Right);
+        break;
+      case BinaryOp::LowerEqual:
+        V = Builder.CreateICmpSLE(Left, Right);
+        break;
+      case BinaryOp::Greater:
+        V = Builder.CreateICmpSGT(Left, Right);
+        break;
+      case BinaryOp::Lower:
+        V = Builder.CreateICmpSLT(Left, Right);
+        break;
+      }
+      return V;
+    }
+
   public:
     // Constructor for the visitor class.
-    ToIRVisitor(Module *M) : M(M), Builder(M->getContext())
+    ToIRVisitor(Module *M, bool UseSSA) : M(M), Builder(M->getContext()), UseSSA(UseSSA)
     {
       // Initialize LLVM types and constants.
       VoidTy = Type::getVoidTy(M->getContext());
@@ -43,8 +364,8 @@ namespace
       CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "print", M);
     }
 
-    // Entry point for generating LLVM IR from the AST.
-    void run(AST *Tree)
+    // Create the main function and position the builder in its entry block.
+    void createMain()
     {
       // Create the main function with the appropriate function type.
       FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
@@ -53,6 +374,209 @@ namespace
       // Create a basic block for the entry point of the main function.
       BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
       Builder.SetInsertPoint(BB);
+    }
+
+    // Variables are either kept in allocas or tracked as SSA values per block.
+    void initVars(const SymbolTable &Symbols)
+    {
+      Ranges = RangeAnalysis(Symbols.size());
+      if (UseSSA)
+        SSA = std::make_unique<SSABuilder>(Int32Ty, Symbols);
+      else
+        Vars.resize(Symbols.size());
+    }
+
+    // A load carries the range of the variable at that point.
+    Value *readVar(uint32_t Sym)
+    {
+      if (SSA)
+        return SSA->read(Sym, Builder.GetInsertBlock());
+      LoadInst *Load = Builder.CreateLoad(Int32Ty, Vars[Sym]);
+      ValueRange R = Ranges.get(Sym);
+      if (!R.isFull() && !R.isEmpty())
+      {
+        ++Counts.RangeLoads;
+        Load->setMetadata(LLVMContext::MD_range,
+                          MDBuilder(M->getContext()).createRange(APInt(32, R.Lo, true),
+                                                                 APInt(32, int64_t(R.Hi) + 1, true)));
+      }
+      return Load;
+    }
+
+    void writeVar(uint32_t Sym, Value *Val, ValueRange R)
+    {
+      Ranges.set(Sym, R);
+      auto It = SharedReaders.find(Sym);
+      if (It != SharedReaders.end())
+      {
+        for (Expr *E : It->second)
+          SharedValues.erase(E);
+        SharedReaders.erase(It);
+      }
+      if (SSA)
+        SSA->write(Sym, Builder.GetInsertBlock(), Val);
+      else
+        Builder.CreateStore(Val, Vars[Sym]);
+    }
+
+    void declareVar(uint32_t Sym, Value *Val, ValueRange R)
+    {
+      if (!SSA)
+        Vars[Sym] = Builder.CreateAlloca(Int32Ty);
+      writeVar(Sym, Val, R);
+    }
+
+    // Append a block created without a parent and continue in it. Blocks are
+    // laid out in the order they are started, not the order they are created.
+    void startBlock(BasicBlock *BB)
+    {
+      BB->insertInto(MainFn);
+      Builder.SetInsertPoint(BB);
+    }
+
+    // Forget the shared values once the insert block has changed.
+    void syncSharedBlock()
+    {
+      if (SharedBB == Builder.GetInsertBlock())
+        return;
+      SharedValues.clear();
+      SharedReaders.clear();
+      SharedDeps.clear();
+      SharedBB = Builder.GetInsertBlock();
+    }
+
+    // Set V to the value of a shared node computed earlier, if it is still valid.
+    bool reuseShared(Expr &Node)
+    {
+      if (!Node.isShared())
+        return false;
+      syncSharedBlock();
+      auto It = SharedValues.find(&Node);
+      if (It == SharedValues.end() || !It->second.Val)
+        return false;
+      V = It->second.Val;
+      VRange = It->second.Range;
+      Reads.append(SharedDeps.begin() + It->second.DepsBegin, SharedDeps.begin() + It->second.DepsEnd);
+      ++Counts.ReusedValues;
+      return true;
+    }
+
+    // Record V as the value of a shared node whose reads start at ReadsBegin.
+    void rememberShared(Expr &Node, size_t ReadsBegin)
+    {
+      if (!Node.isShared())
+        return;
+      syncSharedBlock();
+      unsigned DepsBegin = SharedDeps.size();
+      for (uint32_t Sym : makeArrayRef(Reads).drop_front(ReadsBegin))
+      {
+        if (is_contained(makeArrayRef(SharedDeps).drop_front(DepsBegin), Sym))
+          continue;
+        SharedDeps.push_back(Sym);
+        SharedReaders[Sym].push_back(&Node);
+      }
+      SharedValues[&Node] = {V, VRange, DepsBegin, unsigned(SharedDeps.size())};
+    }
+
+    // A loop header gets its back edges only after the body has been emitted.
+    void beginLoopHeader(BasicBlock *HeaderBB)
+    {
+      if (SSA)
+        SSA->markUnsealed(HeaderBB);
+    }
+
+    void endLoopHeader(BasicBlock *HeaderBB)
+    {
+      if (SSA)
+        SSA->seal(HeaderBB);
+    }
+
+    // The llvm.loop metadata for the hints, or null without any.
+    MDNode *getLoopID(const LoopHints &Hints)
+    {
+      if (!Hints.Unroll && !Hints.Vectorize)
+        return nullptr;
+      LLVMContext &Ctx = M->getContext();
+      SmallVector<Metadata *, 4> Ops{nullptr}; // self reference
+      auto AddHint = [&](StringRef Name, Metadata *Val) {
+        Ops.push_back(Val ? MDNode::get(Ctx, {MDString::get(Ctx, Name), Val})
+                          : MDNode::get(Ctx, MDString::get(Ctx, Name)));
+      };
+      if (Hints.Unroll == 1)
+        AddHint("llvm.loop.unroll.disable", nullptr);
+      else if (Hints.Unroll)
+        AddHint("llvm.loop.unroll.count", ConstantAsMetadata::get(Builder.getInt32(Hints.Unroll)));
+      if (Hints.Vectorize)
+      {
+        AddHint("llvm.loop.vectorize.width", ConstantAsMetadata::get(Builder.getInt32(Hints.Vectorize)));
+        if (Hints.Vectorize > 1)
+          AddHint("llvm.loop.vectorize.enable", ConstantAsMetadata::get(Builder.getInt1(true)));
+      }
+      MDNode *LoopID = MDNode::getDistinct(Ctx, Ops);
+      LoopID->replaceOperandWith(0, LoopID);
+      return LoopID;
+    }
+
+    // A loop, independent of the tree it comes from. AssumeCond and RunBody
+    // apply the condition and the body to the variable ranges only.
+    struct LoopParts
+    {
+      function_ref<void(BasicBlock *TrueBB, BasicBlock *FalseBB)> EmitCond;
+      function_ref<void()> EmitBody;
+      function_ref<void()> AssumeCond;
+      function_ref<void()> RunBody;
+    };
+
+    // Loops are emitted rotated: the condition is tested once before entering
+    // and again at the end of the body, so the body is the loop header and the
+    // latch branches straight back to it. This is the do-while shape LLVM's
+    // loop passes expect, without relying on -O to rotate the loop first.
+    void emitLoop(const LoopParts &Loop, const LoopHints &Hints)
+    {
+      LLVMContext &Ctx = M->getContext();
+      BasicBlock *BodyBB = BasicBlock::Create(Ctx, "loopc.body");
+      BasicBlock *AfterBB = BasicBlock::Create(Ctx, "after.loopc");
+      Loop.EmitCond(BodyBB, AfterBB);
+      // An and/or condition may enter the body from several blocks.
+      SmallPtrSet<BasicBlock *, 4> Entries(pred_begin(BodyBB), pred_end(BodyBB));
+
+      RangeAnalysis::Mark Mark = Ranges.beginLoop(Loop.AssumeCond, Loop.RunBody);
+      startBlock(BodyBB);
+      beginLoopHeader(BodyBB);
+      Loop.EmitBody();
+      Loop.EmitCond(BodyBB, AfterBB);
+      endLoopHeader(BodyBB);
+      Ranges.endLoop(Mark);
+
+      // Every latch carries the loop id.
+      if (MDNode *LoopID = getLoopID(Hints))
+        for (BasicBlock *Pred : predecessors(BodyBB))
+          if (!Entries.count(Pred))
+            Pred->getTerminator()->setMetadata(LLVMContext::MD_loop, LoopID);
+      startBlock(AfterBB);
+    }
+
+    bool hasError() const { return HasError; }
+
+    // Add the counts of this run to the statistics.
+    void countStats()
+    {
+      NumPowChains += Counts.PowChains;
+      NumPowCalls += Counts.PowCalls;
+      NumSwitches += Counts.Switches;
+      NumUnsignedDivs += Counts.UnsignedDivs;
+      NumDivShifts += Counts.DivShifts;
+      NumNUWFlags += Counts.NUWFlags;
+      NumRangeLoads += Counts.RangeLoads;
+      NumPrintBatches += Counts.PrintBatches;
+      NumReusedValues += Counts.ReusedValues;
+    }
+
+    // Entry point for generating LLVM IR from the AST.
+    void run(AST *Tree, const SymbolTable &Symbols)
+    {
+      createMain();
+      initVars(Symbols);
 
       // Visit the root node of the AST to generate IR.
       Tree->accept(*this);
@@ -61,45 +585,348 @@ namespace
       Builder.CreateRet(Int32Zero);
     }
 
+    // Entry point for generating LLVM IR from a flattened tree.
+    void run(const FlatAST &Tree)
+    {
+      createMain();
+      FlatValues.resize(Tree.size());
+      FlatRanges.resize(Tree.size());
+      initVars(Tree.getSymbols());
+
+      ArrayRef<FlatAST::NodeId> Stmts = Tree.getStatements();
+      for (size_t I = 0, E = Stmts.size(); I != E;)
+      {
+        unsigned Prints = countPrints(
+            Stmts, I, [&](FlatAST::NodeId N) { return Tree.getKind(N) == FlatAST::Print; },
+            [&](FlatAST::NodeId N) { return Ranges.mayTrap(Tree, Tree.getPrinted(N)); });
+        if (Prints < 2)
+        {
+          emitFlatStmt(Tree, Stmts[I++]);
+          continue;
+        }
+        emitPrints(Prints, [&](unsigned K) { return emitFlatExpr(Tree, Tree.getPrinted(Stmts[I + K])); });
+        I += Prints;
+      }
+
+      // Create a return instruction at the end of the main function.
+      Builder.CreateRet(Int32Zero);
+    }
+
+    // The arms of an if/elif/else chain, independent of the tree they come from.
+    // The else arm, if any, is the last one.
+    struct IfArms
+    {
+      unsigned NumArms;
+      bool HasElse;
+      function_ref<void(unsigned Arm, BasicBlock *TrueBB, BasicBlock *FalseBB)> EmitCond;
+      function_ref<void(unsigned Arm)> EmitBody;
+      function_ref<void(unsigned Arm, bool Holds)> AssumeCond; // narrow the ranges to the arm's outcome
+    };
+
+    // Conditions that all compare one variable for equality with distinct
+    // constants (or an `or` of such comparisons), as (constant, arm) pairs.
+    struct SwitchCases
+    {
+      uint32_t Sym = ~0u;
+      SmallVector<std::pair<int32_t, unsigned>, 8> Cases;
+      SmallDenseSet<int32_t, 8> Seen;
+
+      bool add(uint32_t S, int32_t Value, unsigned Arm)
+      {
+        if (Sym != ~0u && S != Sym)
+          return false;
+        Sym = S;
+        Cases.emplace_back(Value, Arm);
+        return Seen.insert(Value).second;
+      }
+    };
+
+    // Each arm starts from the variable ranges before the chain, narrowed by
+    // its own condition and by the failed conditions of the arms before it,
+    // which the caller has assumed; the chain ends with their join.
+    void emitArmBody(const IfArms &Arms, unsigned Arm, RangeAnalysis::ArmStates &States)
+    {
+      RangeAnalysis::Mark Mark = Ranges.beginArm();
+      if (Arm < Arms.NumArms - Arms.HasElse)
+        Arms.AssumeCond(Arm, /*Holds=*/true);
+      Arms.EmitBody(Arm);
+      Ranges.endArm(Mark, States);
+    }
+
+    // Each condition branches straight to its body or to the next condition,
+    // and every body falls through to one merge block. With Switch set the
+    // conditions are not evaluated; one switch on the variable picks the arm.
+    void emitIfChain(const IfArms &Arms, const SwitchCases *Switch)
+    {
+      LLVMContext &Ctx = M->getContext();
+      RangeAnalysis::ArmStates States;
+      unsigned NumConds = Arms.NumArms - Arms.HasElse;
+      BasicBlock *AfterBB = BasicBlock::Create(Ctx, "after.ifc");
+      RangeAnalysis::Mark Failed = Ranges.mark(); // conditions of the arms passed
+      if (Switch)
+      {
+        ++Counts.Switches;
+        SmallVector<BasicBlock *, 8> ArmBBs;
+        for (unsigned Arm = 0; Arm != Arms.NumArms; ++Arm)
+          ArmBBs.push_back(BasicBlock::Create(Ctx, Arm < NumConds ? "switch.case" : "elsec.body"));
+        SwitchInst *SI = Builder.CreateSwitch(readVar(Switch->Sym), Arms.HasElse ? ArmBBs.back() : AfterBB,
+                                              Switch->Cases.size());
+        for (const auto &Case : Switch->Cases)
+          SI->addCase(Builder.getInt32(Case.first), ArmBBs[Case.second]);
+        for (unsigned Arm = 0; Arm != Arms.NumArms; ++Arm)
+        {
+          startBlock(ArmBBs[Arm]);
+          emitArmBody(Arms, Arm, States);
+          Builder.CreateBr(AfterBB);
+          if (Arm < NumConds)
+            Arms.AssumeCond(Arm, /*Holds=*/false);
+        }
+        Ranges.rollback(Failed);
+        Ranges.joinArms(States, Arms.HasElse);
+        startBlock(AfterBB);
+        return;
+      }
+
+      for (unsigned Arm = 0; Arm != NumConds; ++Arm)
+      {
+        BasicBlock *BodyBB = BasicBlock::Create(Ctx, "ifc.body");
+        BasicBlock *NextBB = Arm + 1 == Arms.NumArms ? AfterBB
+                             : BasicBlock::Create(Ctx, Arm + 1 == NumConds ? "elsec.body" : "elifc.cond");
+        Arms.EmitCond(Arm, BodyBB, NextBB);
+        startBlock(BodyBB);
+        emitArmBody(Arms, Arm, States);
+        Builder.CreateBr(AfterBB);
+        startBlock(NextBB);
+        Arms.AssumeCond(Arm, /*Holds=*/false);
+      }
+      if (Arms.HasElse)
+      {
+        emitArmBody(Arms, NumConds, States);
+        Builder.CreateBr(AfterBB);
+        startBlock(AfterBB);
+      }
+      Ranges.rollback(Failed);
+      Ranges.joinArms(States, Arms.HasElse);
+    }
+
+    // Match `Var == Constant` in either order, or an `or` of such conditions.
+    bool collectFlatCases(const FlatAST &F, FlatAST::NodeId Cond, unsigned Arm, SwitchCases &SC)
+    {
+      if (F.getKind(Cond) != FlatAST::Binary)
+        return false;
+      if (F.getOperator(Cond) == BinaryOp::Or)
+        return collectFlatCases(F, F.getLeft(Cond), Arm, SC) && collectFlatCases(F, F.getRight(Cond), Arm, SC);
+      if (F.getOperator(Cond) != BinaryOp::DoubleEqual)
+        return false;
+      FlatAST::NodeId Var = F.getLeft(Cond), Value = F.getRight(Cond);
+      if (F.getKind(Var) != FlatAST::Ident)
+        std::swap(Var, Value);
+      if (F.getKind(Var) != FlatAST::Ident || F.getKind(Value) != FlatAST::Number)
+        return false;
+      return SC.add(F.getSymbol(Var), F.getValue(Value), Arm);
+    }
+
+    bool collectCases(Expr *Cond, unsigned Arm, SwitchCases &SC)
+    {
+      auto *Op = dyn_cast<BinaryOp>(Cond);
+      if (!Op)
+        return false;
+      if (Op->getOperator() == BinaryOp::Or)
+        return collectCases(Op->getLeft(), Arm, SC) && collectCases(Op->getRight(), Arm, SC);
+      if (Op->getOperator() != BinaryOp::DoubleEqual)
+        return false;
+      auto *Var = dyn_cast<Factor>(Op->getLeft());
+      auto *Value = dyn_cast<Factor>(Op->getRight());
+      if (!Var || !Value)
+        return false;
+      if (Var->getValueKind() != Factor::Ident)
+        std::swap(Var, Value);
+      int IntValue;
+      if (Var->getValueKind() != Factor::Ident || Value->getValueKind() != Factor::Number ||
+          Value->getVal().getAsInteger(10, IntValue))
+        return false;
+      return SC.add(Var->getSymbol(), IntValue, Arm);
+    }
+
+    // Emit the expression rooted at Root. Its subtree is a contiguous range of
+    // nodes with operands before operators, so it is evaluated in a single
+    // forward pass. An and/or is opened at its Logical node and closed at its
+    // Binary node, so the innermost one is closed first.
+    Value *emitFlatExpr(const FlatAST &F, FlatAST::NodeId Root)
+    {
+      SmallVector<LogicalBlocks, 4> Open;
+      for (FlatAST::NodeId N = F.getSubtreeBegin(Root); N <= Root; ++N)
+      {
+        switch (F.getKind(N))
+        {
+        case FlatAST::Number:
+          FlatValues[N] = ConstantInt::get(Int32Ty, F.getValue(N), true);
+          FlatRanges[N] = ValueRange::constant(F.getValue(N));
+          break;
+        case FlatAST::Ident:
+          FlatValues[N] = readVar(F.getSymbol(N));
+          FlatRanges[N] = Ranges.get(F.getSymbol(N));
+          break;
+        case FlatAST::Logical:
+          Open.push_back(beginLogical(F.getOperator(N), FlatValues[F.getLeft(N)],
+                                      [&](bool Holds) { Ranges.assume(F, F.getLeft(N), Holds); }));
+          break;
+        case FlatAST::Binary:
+          if (isLogical(F.getOperator(N)))
+            FlatValues[N] = endLogical(F.getOperator(N), Open.pop_back_val(),
+                                       FlatValues[F.getRight(N)]);
+          else
+            FlatValues[N] = emitBinary(F.getOperator(N), FlatValues[F.getLeft(N)], FlatRanges[F.getLeft(N)],
+                                       FlatValues[F.getRight(N)], FlatRanges[F.getRight(N)]);
+          FlatRanges[N] = getBinaryRange(F.getOperator(N), FlatRanges[F.getLeft(N)], FlatRanges[F.getRight(N)]);
+          break;
+        default:
+          llvm_unreachable("statement inside an expression");
+        }
+      }
+      return FlatValues[Root];
+    }
+
+    // Branch on a condition. An and/or condition branches on each operand in
+    // turn instead of materializing its value.
+    void emitFlatBranch(const FlatAST &F, FlatAST::NodeId Cond, BasicBlock *TrueBB, BasicBlock *FalseBB)
+    {
+      if (F.getKind(Cond) != FlatAST::Binary || !isLogical(F.getOperator(Cond)))
+      {
+        Builder.CreateCondBr(toBool(emitFlatExpr(F, Cond)), TrueBB, FalseBB);
+        return;
+      }
+      bool IsAnd = F.getOperator(Cond) == BinaryOp::And;
+      BasicBlock *RHSBB = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", MainFn);
+      emitFlatBranch(F, F.getLeft(Cond), IsAnd ? RHSBB : TrueBB, IsAnd ? FalseBB : RHSBB);
+      Builder.SetInsertPoint(RHSBB);
+      RangeAnalysis::Mark Mark = Ranges.mark();
+      Ranges.assume(F, F.getLeft(Cond), IsAnd);
+      emitFlatBranch(F, F.getRight(Cond), TrueBB, FalseBB);
+      Ranges.rollback(Mark);
+    }
+
+    void emitFlatBody(const FlatAST &F, ArrayRef<FlatAST::NodeId> Body)
+    {
+      for (FlatAST::NodeId N : Body)
+        emitFlatStmt(F, N);
+    }
+
+    void emitFlatStmt(const FlatAST &F, FlatAST::NodeId N)
+    {
+      switch (F.getKind(N))
+      {
+      case FlatAST::Assign:
+        writeVar(F.getSymbol(N), toInt(emitFlatExpr(F, F.getAssignedValue(N))),
+                 FlatRanges[F.getAssignedValue(N)]);
+        break;
+      case FlatAST::Print:
+        Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {toInt(emitFlatExpr(F, F.getPrinted(N)))});
+        break;
+      case FlatAST::Decl: {
+        ArrayRef<FlatAST::NodeId> Exprs = F.getDeclExprs(N);
+        ArrayRef<uint32_t> Syms = F.getDeclVars(N);
+        for (size_t I = 0, E = Syms.size(); I != E; ++I)
+        {
+          // Variables without an initializer start at zero.
+          if (I < Exprs.size())
+            declareVar(Syms[I], toInt(emitFlatExpr(F, Exprs[I])), FlatRanges[Exprs[I]]);
+          else
+            declareVar(Syms[I], Int32Zero, ValueRange::constant(0));
+        }
+        break;
+      }
+      case FlatAST::IfElse: {
+        unsigned NumArms = F.getNumArms(N);
+        bool HasElse = F.getArmCondition(N, NumArms - 1) == FlatAST::None;
+        SwitchCases SC;
+        bool IsSwitch = NumArms - HasElse > 1;
+        for (unsigned Arm = 0; IsSwitch && Arm != NumArms - HasElse; ++Arm)
+          IsSwitch = collectFlatCases(F, F.getArmCondition(N, Arm), Arm, SC);
+        emitIfChain({NumArms, HasElse,
+                     [&](unsigned Arm, BasicBlock *TrueBB, BasicBlock *FalseBB) {
+                       emitFlatBranch(F, F.getArmCondition(N, Arm), TrueBB, FalseBB);
+                     },
+                     [&](unsigned Arm) { emitFlatBody(F, F.getArmBody(N, Arm)); },
+                     [&](unsigned Arm, bool Holds) { Ranges.assume(F, F.getArmCondition(N, Arm), Holds); }},
+                    IsSwitch ? &SC : nullptr);
+        break;
+      }
+      case FlatAST::Loop:
+        emitLoop({[&](BasicBlock *TrueBB, BasicBlock *FalseBB) {
+                    emitFlatBranch(F, F.getLoopCondition(N), TrueBB, FalseBB);
+                  },
+                  [&] { emitFlatBody(F, F.getLoopBody(N)); },
+                  [&] { Ranges.assume(F, F.getLoopCondition(N)); },
+                  [&] {
+                    for (FlatAST::NodeId A : F.getLoopBody(N))
+                      Ranges.set(F.getSymbol(A), Ranges.eval(F, F.getAssignedValue(A)));
+                  }},
+                 F.getLoopHints(N));
+        break;
+      default:
+        llvm_unreachable("expression used as a statement");
+      }
+    }
+
     // Visit function for the GSM node in the AST.
-    virtual void visit(GSM &Node) override
+    void visit(GSM &Node)
     {
-      // Iterate over the children of the GSM node and visit each child.
-      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      // Visit each child, except that runs of prints are emitted together.
+      ArrayRef<Expr *> Stmts = Node.getExprs();
+      for (size_t I = 0, E = Stmts.size(); I != E;)
       {
-        (*I)->accept(*this);
+        unsigned Prints = countPrints(
+            Stmts, I, [](Expr *S) { return isa<Print>(S); },
+            [&](Expr *S) { return Ranges.mayTrap(cast<Print>(S)->getExpr()); });
+        if (Prints < 2)
+        {
+          Stmts[I++]->accept(*this);
+          continue;
+        }
+        emitPrints(Prints, [&](unsigned K) {
+          Reads.clear();
+          cast<Print>(Stmts[I + K])->getExpr()->accept(*this);
+          return V;
+        });
+        I += Prints;
       }
     };
 
-    virtual void visit(Print &Node) override
+    void visit(Print &Node)
     {
+      Reads.clear();
       // Visit the right-hand side of the assignment and get its value.
       Node.getExpr()->accept(*this);
-      Value *val = V;
+      Value *val = toInt(V);
 
       // Create a call instruction to invoke the "print" function with the value.
       CallInst *Call = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {val});
     };
 
-    virtual void visit(Assignment &Node) override
+    void visit(Assignment &Node)
     {
+      Reads.clear();
       // Visit the right-hand side of the assignment and get its value.
       Node.getRight()->accept(*this);
-      Value *val = V;
+      Value *val = toInt(V);
 
-      // Get the name of the variable being assigned.
-      auto varName = Node.getLeft()->getVal();
-
-      // Create a store instruction to assign the value to the variable.
-      Builder.CreateStore(val, nameMap[varName]);
+      // Assign the value to the variable.
+      writeVar(Node.getLeft()->getSymbol(), val, VRange);
     };
 
-    virtual void visit(Factor &Node) override
+    void visit(Factor &Node)
     {
-      if (Node.getKind() == Factor::Ident)
+      if (Node.getValueKind() == Factor::Ident)
       {
-        // If the factor is an identifier, load its value from memory.
-        V = Builder.CreateLoad(Int32Ty, nameMap[Node.getVal()]);
+        // If the factor is an identifier, read its current value.
+        if (reuseShared(Node))
+          return;
+        size_t ReadsBegin = Reads.size();
+        V = readVar(Node.getSymbol());
+        VRange = Ranges.get(Node.getSymbol());
+        Reads.push_back(Node.getSymbol());
+        rememberShared(Node, ReadsBegin);
       }
       else
       {
@@ -107,104 +934,67 @@ namespace
         int intval;
         Node.getVal().getAsInteger(10, intval);
         V = ConstantInt::get(Int32Ty, intval, true);
+        VRange = ValueRange::constant(intval);
       }
     };
 
-    virtual void visit(BinaryOp &Node) override
+    // Branch on a condition; see emitFlatBranch.
+    void emitBranch(Expr *Cond, BasicBlock *TrueBB, BasicBlock *FalseBB)
+    {
+      auto *Op = dyn_cast<BinaryOp>(Cond);
+      if (!Op || !isLogical(Op->getOperator()))
+      {
+        Reads.clear();
+        Cond->accept(*this);
+        Builder.CreateCondBr(toBool(V), TrueBB, FalseBB);
+        return;
+      }
+      bool IsAnd = Op->getOperator() == BinaryOp::And;
+      BasicBlock *RHSBB = BasicBlock::Create(M->getContext(), IsAnd ? "and.rhs" : "or.rhs", MainFn);
+      emitBranch(Op->getLeft(), IsAnd ? RHSBB : TrueBB, IsAnd ? FalseBB : RHSBB);
+      Builder.SetInsertPoint(RHSBB);
+      RangeAnalysis::Mark Mark = Ranges.mark();
+      Ranges.assume(Op->getLeft(), IsAnd);
+      emitBranch(Op->getRight(), TrueBB, FalseBB);
+      Ranges.rollback(Mark);
+    }
+
+    void visit(BinaryOp &Node)
     {
+      if (reuseShared(Node))
+        return;
+      size_t ReadsBegin = Reads.size();
+
       // Visit the left-hand side of the binary operation and get its value.
       Node.getLeft()->accept(*this);
       Value *Left = V;
+      ValueRange LR = VRange;
 
-      // Visit the right-hand side of the binary operation and get its value.
-      Node.getRight()->accept(*this);
-      Value *Right = V;
-
-      // Perform the binary operation based on the operator type and create the corresponding instruction.
-      switch (Node.getOperator())
+      // The right-hand side of and/or is only evaluated when it decides the result.
+      if (isLogical(Node.getOperator()))
       {
-      case BinaryOp::Plus:
-        V = Builder.CreateNSWAdd(Left, Right);
-        break;
-      case BinaryOp::Minus:
-        V = Builder.CreateNSWSub(Left, Right);
-        break;
-      case BinaryOp::Mul:
-        V = Builder.CreateNSWMul(Left, Right);
-        break;
-      case BinaryOp::Div:
-        V = Builder.CreateSDiv(Left, Right);
-        break;
-      case BinaryOp::Mod: {
-        V = Builder.CreateSRem(Left, Right);
-        break;
+        LogicalBlocks Blocks = beginLogical(Node.getOperator(), Left,
+                                            [&](bool Holds) { Ranges.assume(Node.getLeft(), Holds); });
+        Node.getRight()->accept(*this);
+        V = endLogical(Node.getOperator(), Blocks, V);
+        VRange = {0, 1};
       }
-      case BinaryOp::Power: {
-        llvm::Value* tmp = Builder.CreateNSWAdd(Builder.getInt32(0), Right);
-        llvm::AllocaInst* LocalVar = Builder.CreateAlloca(Int32Ty);
-        Builder.CreateStore(tmp, LocalVar);
-
-        tmp = Builder.CreateNSWAdd(Builder.getInt32(1), Builder.getInt32(0));
-        llvm::AllocaInst* LocalVar2 = Builder.CreateAlloca(Int32Ty);
-        Builder.CreateStore(tmp, LocalVar2);
-
-        llvm::BasicBlock* PowerCondBB = llvm::BasicBlock::Create(M->getContext(), "power.cond", MainFn);
-        llvm::BasicBlock* PowerBodyBB = llvm::BasicBlock::Create(M->getContext(), "power.body", MainFn);
-        llvm::BasicBlock* AfterPowerBB = llvm::BasicBlock::Create(M->getContext(), "after.power", MainFn);
-
-        Builder.CreateBr(PowerCondBB);
-        Builder.SetInsertPoint(PowerCondBB);
-
-        tmp = Builder.CreateLoad(LocalVar);
-        llvm::Value* condition = Builder.CreateICmpSGT(tmp, Builder.getInt32(0));
-        Builder.CreateCondBr(condition, PowerBodyBB, AfterPowerBB);
-
-        Builder.SetInsertPoint(PowerBodyBB);
-
-        tmp = Builder.CreateLoad(LocalVar2);
-        tmp = Builder.CreateNSWMul(tmp, Left);
-        Builder.CreateStore(tmp, LocalVar2);
-
-        tmp = Builder.CreateLoad(LocalVar);
-        tmp = Builder.CreateNSWSub(tmp, Builder.getInt32(1));
-        Builder.CreateStore(tmp, LocalVar);
-
-        Builder.CreateBr(PowerCondBB);
-        Builder.SetInsertPoint(AfterPowerBB);
-
-        V = Builder.CreateLoad(LocalVar2);
+      else
+      {
+        // Visit the right-hand side of the binary operation and get its value.
+        Node.getRight()->accept(*this);
+        Value *Right = V;
+        ValueRange RR = VRange;
 
-        break;
-      }
-      case BinaryOp::Or:
-        V = Builder.CreateOr(Left, Right);
-        break;
-      case BinaryOp::And:
-        V = Builder.CreateAnd(Left, Right);
-        break;
-      case BinaryOp::DoubleEqual:
-        V = Builder.CreateICmpEQ(Left, Right);
-        break;
-      case BinaryOp::NotEqual:
-        V = Builder.CreateICmpNE(Left, Right);
-        break;
-      case BinaryOp::GreaterEqual:
-        V = Builder.CreateICmpSGE(Left, Right);
-        break;
-      case BinaryOp::LowerEqual:
-        V = Builder.CreateICmpSLE(Left, Right);
-        break;
-      case BinaryOp::Greater:
-        V = Builder.CreateICmpSGT(Left, Right);
-        break;
-      case BinaryOp::Lower:
-        V = Builder.CreateICmpSLT(Left, Right);
-        break;
+        V = emitBinary(Node.getOperator(), Left, LR, Right, RR);
+        VRange = getBinaryRange(Node.getOperator(), LR, RR);
       }
+      rememberShared(Node, ReadsBegin);
     };
 
-    virtual void visit(Declaration &Node) override {
+    void visit(Declaration &Node) {
       Value *val = nullptr;
+      ValueRange Range;
 
       
       auto Ie = Node.begin_exprs();
@@ -216,24 +1006,22 @@ namespace
 
       // Iterate over the variables declared in the declaration statement.
       for (auto I = Node.begin_vars(), E = Node.end_vars(); I != E; ++I, ++count_vars, ++count_exprs) {
-        StringRef Var = *I;
+        uint32_t Var = *I;
 
         if (Ie != Ee) {
+          Reads.clear();
           (* Ie) -> accept(*this);
-          val = V;
+          val = toInt(V);
+          Range = VRange;
           Ie++;
         } else if (Ie == Ee || finishedExprs) {
           finishedExprs = true;
           val = ConstantInt::get(Int32Ty, 0, true);
+          Range = ValueRange::constant(0);
         }
       
-        // Create an alloca instruction to allocate memory for the variable.
-        nameMap[Var] = Builder.CreateAlloca(Int32Ty);
-
-        // Store the initial value (if any) in the variable's memory location.
-        if (val != nullptr) {
-          Builder.CreateStore(val, nameMap[Var]);
-        }
+        // Create the variable with its initial value.
+        declareVar(Var, val, Range);
       }
       while (Ie != Ee || count_exprs <= count_vars) {
         count_exprs++;
@@ -241,109 +1029,199 @@ namespace
       if (count_exprs > count_vars) {} //TODO: Should raise error
     };
 
-    virtual void visit(IfElse &Node) override {
-      llvm::SmallVector<Expr *> conditions = Node.getConditions();
-      llvm::SmallVector<llvm::SmallVector<Assignment *>> assignments_of_assignments = Node.getAssignments();
-      llvm::BasicBlock* ifCondBB;
-      llvm::BasicBlock* ifBodyBB;
-      llvm::BasicBlock* AfterifBB;
-      llvm::BasicBlock* elseBodyBB;
-      llvm::BasicBlock* AferAllBB = llvm::BasicBlock::Create(M->getContext(), "afterAll", MainFn);
-
-      int count_conditions = 0;
-      int count_assignments = 0;
-      for (auto I = assignments_of_assignments.begin(), E = assignments_of_assignments.end(); I != E; ++I) count_assignments++;
-      for (auto I = conditions.begin(), E = conditions.end(); I != E; ++I) count_conditions++;
-
-      auto condition = conditions.begin();
-      auto condition_end = conditions.end();
-      bool reached_else = false;
-      bool first = true;
-
-      int i = 0;
-      int j = 0;
-
-      bool end_of_statements = false;
-
-      for (auto I = assignments_of_assignments.begin(), E = assignments_of_assignments.end(); I != E; ++I){
-        i++;
-        end_of_statements = count_assignments == count_conditions && count_assignments == i;
-        if (condition == condition_end) reached_else = true;
-        else j++;
-
-        if (first) {
-          ifCondBB = llvm::BasicBlock::Create(M->getContext(), "ifc.cond", MainFn);
-          ifBodyBB = llvm::BasicBlock::Create(M->getContext(), "ifc.body", MainFn);
-          if (!end_of_statements)
-            AfterifBB = llvm::BasicBlock::Create(M->getContext(), "after.ifc", MainFn);
-          first = false;
-        } else {
-          if (!reached_else) {
-            ifCondBB = llvm::BasicBlock::Create(M->getContext(), "elifc.cond", MainFn);
-            ifBodyBB = llvm::BasicBlock::Create(M->getContext(), "elifc.body", MainFn);
-            if (!end_of_statements)
-              AfterifBB = llvm::BasicBlock::Create(M->getContext(), "after.elifc", MainFn);
-          }
-        }
-
-        if (!reached_else) {
-          Builder.CreateBr(ifCondBB);
-          Builder.SetInsertPoint(ifCondBB);
-
-          (*condition)->accept(*this);
-          Value* val=V;
-          if (end_of_statements) Builder.CreateCondBr(val, ifBodyBB, AferAllBB);
-          else Builder.CreateCondBr(val, ifBodyBB, AfterifBB);
-          Builder.SetInsertPoint(ifBodyBB);
-        } else {
-          elseBodyBB = llvm::BasicBlock::Create(M->getContext(), "elsec.body", MainFn);
-          Builder.CreateBr(elseBodyBB);
-          Builder.SetInsertPoint(elseBodyBB);
-        }
-
-        for (auto II = I -> begin(), EE =  I -> end(); II != EE; ++II){
-          (*II)->accept(*this);
-        }
-        Builder.CreateBr(AferAllBB);
-        if (!reached_else && !end_of_statements)
-          Builder.SetInsertPoint(AfterifBB);
-        
-        condition++;
-      }
-      Builder.SetInsertPoint(AferAllBB);
+    void visit(IfElse &Node) {
+      llvm::ArrayRef<Expr *> Conditions = Node.getConditions();
+      llvm::ArrayRef<llvm::ArrayRef<Assignment *>> Bodies = Node.getAssignments();
+      SwitchCases SC;
+      bool IsSwitch = Conditions.size() > 1;
+      for (unsigned Arm = 0; IsSwitch && Arm != Conditions.size(); ++Arm)
+        IsSwitch = collectCases(Conditions[Arm], Arm, SC);
+      emitIfChain({unsigned(Bodies.size()), Bodies.size() > Conditions.size(),
+                   [&](unsigned Arm, BasicBlock *TrueBB, BasicBlock *FalseBB) {
+                     emitBranch(Conditions[Arm], TrueBB, FalseBB);
+                   },
+                   [&](unsigned Arm) {
+                     for (Assignment *A : Bodies[Arm])
+                       A->accept(*this);
+                   },
+                   [&](unsigned Arm, bool Holds) { Ranges.assume(Conditions[Arm], Holds); }},
+                  IsSwitch ? &SC : nullptr);
     };
 
-  virtual void visit(Loop &Node) override {
-      llvm::BasicBlock* WhileCondBB = llvm::BasicBlock::Create(M->getContext(), "loopc.cond", MainFn);
-      llvm::BasicBlock* WhileBodyBB = llvm::BasicBlock::Create(M->getContext(), "loopc.body", MainFn);
-      llvm::BasicBlock* AfterWhileBB = llvm::BasicBlock::Create(M->getContext(), "after.loopc", MainFn);
-
-      Builder.CreateBr(WhileCondBB);
-      Builder.SetInsertPoint(WhileCondBB);
-      Node.getCondition()->accept(*this);
-      Value* val=V;
-      Builder.CreateCondBr(val, WhileBodyBB, AfterWhileBB);
-      Builder.SetInsertPoint(WhileBodyBB);
-      llvm::SmallVector<Assignment* > assignments = Node.getAssignments();
-      for (auto I = assignments.begin(), E = assignments.end(); I != E; ++I){
-        (*I)->accept(*this);
-      }
-      Builder.CreateBr(WhileCondBB);
-      Builder.SetInsertPoint(AfterWhileBB);
+  void visit(::Loop &Node) {
+      emitLoop({[&](BasicBlock *TrueBB, BasicBlock *FalseBB) { emitBranch(Node.getCondition(), TrueBB, FalseBB); },
+                [&] {
+                  for (Assignment *A : Node.getAssignments())
+                    A->accept(*this);
+                },
+                [&] { Ranges.assume(Node.getCondition()); },
+                [&] {
+                  for (Assignment *A : Node.getAssignments())
+                    Ranges.set(A->getLeft()->getSymbol(), Ranges.eval(A->getRight()));
+                }},
+               Node.getHints());
   };
 };
 }; // namespace
 
-void CodeGen::compile(AST *Tree)
+std::unique_ptr<Module> CodeGen::createModule(LLVMContext &Ctx)
+{
+  // Create a module in the caller's context.
+  auto M = std::make_unique<Module>("calc.expr", Ctx);
+  if (TM)
+  {
+    M->setTargetTriple(TM->getTargetTriple().str());
+    M->setDataLayout(TM->createDataLayout());
+  }
+  return M;
+}
+
+// Add the size of the module to the statistics; walked only when they are enabled.
+static void countIR(const Module &M, TrackingStatistic &Blocks, TrackingStatistic &Insts,
+                    TrackingStatistic *Allocas = nullptr)
+{
+  if (!AreStatisticsEnabled())
+    return;
+  for (const Function &F : M)
+    for (const BasicBlock &BB : F)
+    {
+      ++Blocks;
+      Insts += BB.size();
+      if (Allocas)
+        for (const Instruction &I : BB)
+          if (isa<AllocaInst>(I))
+            ++*Allocas;
+    }
+}
+
+std::unique_ptr<Module> CodeGen::compile(AST *Tree, const SymbolTable &Symbols, LLVMContext &Ctx)
+{
+  std::unique_ptr<Module> M = createModule(Ctx);
+
+  {
+    // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
+    PhaseTimer Timer("irgen", "IR building");
+    ToIRVisitor ToIR(M.get(), UseSSA);
+    ToIR.run(Tree, Symbols);
+    ToIR.countStats();
+    if (ToIR.hasError())
+      return nullptr;
+  }
+  countIR(*M, NumBlocks, NumInsts, &NumAllocas);
+
+  if ((LinkRuntime && linkRuntime(*M)) || optimize(*M))
+    return nullptr;
+  return M;
+}
+
+std::unique_ptr<Module> CodeGen::compile(const FlatAST &Tree, LLVMContext &Ctx)
+{
+  std::unique_ptr<Module> M = createModule(Ctx);
+
+  {
+    PhaseTimer Timer("irgen", "IR building");
+    ToIRVisitor ToIR(M.get(), UseSSA);
+    ToIR.run(Tree);
+    ToIR.countStats();
+    if (ToIR.hasError())
+      return nullptr;
+  }
+  countIR(*M, NumBlocks, NumInsts, &NumAllocas);
+
+  if ((LinkRuntime && linkRuntime(*M)) || optimize(*M))
+    return nullptr;
+  return M;
+}
+
+// Only the runtime functions the program calls are linked in. They become
+// internal, so the optimiser can inline them and drop what is left, and an
+// executable does not need the runtime library for them.
+bool CodeGen::linkRuntime(Module &M)
+{
+  PhaseTimer Timer("runtime", "Runtime linking");
+  Expected<std::unique_ptr<Module>> Runtime = loadRuntime(M.getContext());
+  if (!Runtime)
+  {
+    errs() << "Could not load the runtime: " << toString(Runtime.takeError()) << "\n";
+    return true;
+  }
+  (*Runtime)->setDataLayout(M.getDataLayout());
+  (*Runtime)->setTargetTriple(M.getTargetTriple());
+
+  // The runtime buffers its output, so main writes it out before returning.
+  FunctionCallee Flush = M.getOrInsertFunction("gsm_flush", Type::getVoidTy(M.getContext()));
+  for (BasicBlock &BB : *M.getFunction("main"))
+    if (auto *Ret = dyn_cast<ReturnInst>(BB.getTerminator()))
+      CallInst::Create(Flush, "", Ret);
+
+  auto Internalize = [](Module &M, const StringSet<> &Linked) {
+    internalizeModule(M, [&Linked](const GlobalValue &GV) { return !Linked.count(GV.getName()); });
+  };
+  if (Linker::linkModules(M, std::move(*Runtime), Linker::LinkOnlyNeeded, Internalize))
+  {
+    errs() << "Could not link the runtime\n";
+    return true;
+  }
+
+  // Each print inlined into main makes the inliner analyse all of main again,
+  // which gets quadratic for programs with thousands of them. Only the first
+  // MaxInlinedPrints calls are left to the inliner; the others still call the
+  // buffered runtime.
+  Function *Print = M.getFunction("print");
+  unsigned NumPrints = 0;
+  for (BasicBlock &BB : *M.getFunction("main"))
+    for (Instruction &I : BB)
+      if (auto *Call = dyn_cast<CallBase>(&I))
+        if (Call->getCalledFunction() == Print && ++NumPrints > MaxInlinedPrints)
+          Call->setIsNoInline();
+  return false;
+}
+
+bool CodeGen::optimize(Module &M)
 {
-  // Create an LLVM context and a module.
-  LLVMContext Ctx;
-  Module *M = new Module("calc.expr", Ctx);
+  // -O0 without a custom pipeline leaves the IR exactly as it was built.
+  if (OptLevel == 0 && Passes.empty())
+    return false;
+
+  PhaseTimer Timer("optimize", "Optimization");
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  // The standard instrumentations time each pass for -time-passes and add
+  // them to the -ftime-trace profile.
+  PassInstrumentationCallbacks PIC;
+  StandardInstrumentations SI(/*DebugLogging=*/false);
+  SI.registerCallbacks(PIC, &FAM);
 
-  // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-  ToIRVisitor ToIR(M);
-  ToIR.run(Tree);
+  PassBuilder PB(TM, PipelineTuningOptions(), None, &PIC);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (!Passes.empty())
+  {
+    if (Error Err = PB.parsePassPipeline(MPM, Passes))
+    {
+      errs() << "Invalid pass pipeline: " << toString(std::move(Err)) << "\n";
+      return true;
+    }
+  }
+  else
+  {
+    OptimizationLevel Level = OptimizationLevel::O1;
+    if (OptLevel == 2)
+      Level = OptimizationLevel::O2;
+    else if (OptLevel >= 3)
+      Level = OptimizationLevel::O3;
+    MPM = PB.buildPerModuleDefaultPipeline(Level);
+  }
 
-  // Print the generated module to the standard output.
-  M->print(outs(), nullptr);
+  MPM.run(M, MAM);
+  countIR(M, NumOptBlocks, NumOptInsts);
+  return false;
 }
@@ -2,11 +2,35 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "FlatAST.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
 
 class CodeGen
 {
+  llvm::TargetMachine *TM;   // target to optimise for, may be null
+  unsigned OptLevel;         // -O level of the default pipeline
+  std::string Passes;        // custom pipeline replacing the default one
+  bool UseSSA;               // build SSA values directly instead of allocas
+  bool LinkRuntime;          // link the runtime into the module instead of calling it externally
+  unsigned MaxInlinedPrints; // print calls in main the inliner may inline, with LinkRuntime
+
+  std::unique_ptr<llvm::Module> createModule(llvm::LLVMContext &Ctx);
+  bool linkRuntime(llvm::Module &M);
+  bool optimize(llvm::Module &M);
+
 public:
- void compile(AST *Tree);
+ CodeGen(llvm::TargetMachine *TM = nullptr, unsigned OptLevel = 0, llvm::StringRef Passes = "",
+         bool UseSSA = false, bool LinkRuntime = false, unsigned MaxInlinedPrints = 512)
+     : TM(TM), OptLevel(OptLevel), Passes(Passes.str()), UseSSA(UseSSA), LinkRuntime(LinkRuntime),
+       MaxInlinedPrints(MaxInlinedPrints) {}
+
+ // Build and optimise the LLVM module for the AST; the caller decides whether to
+ // print or run it. Returns null if a division is provably by zero or the
+ // custom pass pipeline is invalid.
+ std::unique_ptr<llvm::Module> compile(AST *Tree, const SymbolTable &Symbols, llvm::LLVMContext &Ctx);
+ std::unique_ptr<llvm::Module> compile(const FlatAST &Tree, llvm::LLVMContext &Ctx);
 
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "FlatAST.h"
+#include "llvm/Support/ErrorHandling.h"
+
+// FlatASTBuilder walks the pointer AST and appends every node after its children.
+class FlatASTBuilder : public ASTVisitor<FlatASTBuilder>
+{
+  FlatAST &F;
+  FlatAST::NodeId Last;                // id of the node appended last
+
+  FlatAST::NodeId add(FlatAST::NodeKind Kind, uint32_t L, uint32_t R = 0, uint8_t Op = 0)
+  {
+    F.Kinds.push_back(Kind);
+    F.Ops.push_back(Op);
+    F.LHS.push_back(L);
+    F.RHS.push_back(R);
+    return Last = F.Kinds.size() - 1;
+  }
+
+  uint32_t addList(llvm::ArrayRef<uint32_t> Elts)
+  {
+    uint32_t Offset = F.Extra.size();
+    F.Extra.push_back(Elts.size());
+    F.Extra.append(Elts.begin(), Elts.end());
+    return Offset;
+  }
+
+  FlatAST::NodeId flatten(AST *Node)
+  {
+    Node->accept(*this);
+    return Last;
+  }
+
+  uint32_t flattenBody(llvm::ArrayRef<Assignment *> Body)
+  {
+    llvm::SmallVector<uint32_t, 8> Ids;
+    for (Assignment *A : Body)
+      Ids.push_back(flatten(A));
+    return addList(Ids);
+  }
+
+public:
+  FlatASTBuilder(FlatAST &F) : F(F), Last(0) {}
+
+  void visit(GSM &Node)
+  {
+    for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      F.Statements.push_back(flatten(*I));
+  };
+
+  void visit(Factor &Node)
+  {
+    if (Node.getValueKind() == Factor::Ident)
+      add(FlatAST::Ident, Node.getSymbol());
+    else
+    {
+      int intval;
+      if (Node.getVal().getAsInteger(10, intval))
+        llvm_unreachable("the parser rejects literals that do not fit in 32 bits");
+      add(FlatAST::Number, uint32_t(intval));
+    }
+  };
+
+  void visit(BinaryOp &Node)
+  {
+    FlatAST::NodeId L = flatten(Node.getLeft());
+    if (Node.getOperator() == BinaryOp::And || Node.getOperator() == BinaryOp::Or)
+      add(FlatAST::Logical, L, 0, Node.getOperator());
+    FlatAST::NodeId R = flatten(Node.getRight());
+    add(FlatAST::Binary, L, R, Node.getOperator());
+  };
+
+  void visit(Assignment &Node)
+  {
+    FlatAST::NodeId R = flatten(Node.getRight());
+    add(FlatAST::Assign, Node.getLeft()->getSymbol(), R);
+  };
+
+  void visit(Declaration &Node)
+  {
+    llvm::SmallVector<uint32_t, 8> Exprs;
+    for (auto I = Node.begin_exprs(), E = Node.end_exprs(); I != E; ++I)
+      Exprs.push_back(flatten(*I));
+    uint32_t VarList = addList(llvm::ArrayRef<uint32_t>(Node.begin_vars(), Node.end_vars()));
+    add(FlatAST::Decl, VarList, addList(Exprs));
+  };
+
+  void visit(Print &Node)
+  {
+    add(FlatAST::Print, flatten(Node.getExpr()));
+  };
+
+  void visit(IfElse &Node)
+  {
+    llvm::ArrayRef<Expr *> Conditions = Node.getConditions();
+    llvm::ArrayRef<llvm::ArrayRef<Assignment *>> Bodies = Node.getAssignments();
+
+    // Arms are flattened in source order; the one without a condition is the else.
+    llvm::SmallVector<uint32_t, 8> Arms;
+    for (size_t I = 0, E = Bodies.size(); I != E; ++I)
+    {
+      Arms.push_back(I < Conditions.size() ? flatten(Conditions[I]) : FlatAST::None);
+      Arms.push_back(flattenBody(Bodies[I]));
+    }
+    uint32_t Table = F.Extra.size();
+    F.Extra.append(Arms.begin(), Arms.end());
+    add(FlatAST::IfElse, Table, Bodies.size());
+  };
+
+  void visit(Loop &Node)
+  {
+    FlatAST::NodeId Cond = flatten(Node.getCondition());
+    uint32_t Body = flattenBody(Node.getAssignments());
+    uint32_t Table = F.Extra.size();
+    F.Extra.append({Node.getHints().Unroll, Node.getHints().Vectorize, Body});
+    add(FlatAST::Loop, Cond, Table);
+  };
+};
+
+FlatAST FlatAST::build(AST *Tree, const SymbolTable &Symbols)
+{
+  FlatAST F;
+  F.Symbols = &Symbols;
+  FlatASTBuilder Builder(F);
+  Tree->accept(Builder);
+  return F;
+}
+
+size_t FlatAST::getMemoryUsage() const
+{
+  return Kinds.capacity_in_bytes() + Ops.capacity_in_bytes() + LHS.capacity_in_bytes() +
+         RHS.capacity_in_bytes() + Extra.capacity_in_bytes() +
+         Statements.capacity_in_bytes();
+}
@@ -0,0 +1,108 @@
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include "AST.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+
+// FlatAST is a compact, index-based form of the AST. Node kinds, operators and
+// operands live in parallel arrays addressed by 32-bit node ids, and every node is
+// stored after its children (post-order). A statement is therefore preceded by all
+// of its expression nodes, the subtree of an expression is the contiguous range
+// [getSubtreeBegin(N), N], and walking the ids in order visits the program in
+// source order. The operands of `and`/`or` are separated by a Logical node so that
+// a forward walk can branch around the right operand.
+class FlatAST
+{
+public:
+  using NodeId = uint32_t;
+
+  static constexpr uint32_t None = ~0u; // condition of an else arm
+
+  enum NodeKind : uint8_t
+  {
+    Number,  // LHS: literal value
+    Ident,   // LHS: symbol id
+    Binary,  // Op: BinaryOp::Operator, LHS/RHS: operand nodes
+    Logical, // Op: And/Or, LHS: left operand; the right operand follows
+    Assign,  // LHS: symbol id, RHS: value node
+    Decl,    // LHS: list of symbol ids, RHS: list of initializer nodes
+    Print,   // LHS: printed node
+    IfElse,  // LHS: arm table, RHS: number of arms
+    Loop     // LHS: condition node, RHS: loop table
+  };
+
+private:
+  llvm::SmallVector<uint8_t, 0> Kinds;
+  llvm::SmallVector<uint8_t, 0> Ops;
+  llvm::SmallVector<uint32_t, 0> LHS;
+  llvm::SmallVector<uint32_t, 0> RHS;
+
+  // Variable length operands. A list is stored as its length followed by its
+  // elements and referred to by the offset of the length; an IfElse arm table holds
+  // a (condition node, body list) pair per arm, and a Loop table holds the unroll
+  // and vectorize hints followed by the body list.
+  llvm::SmallVector<uint32_t, 0> Extra;
+
+  const SymbolTable *Symbols = nullptr;      // spelling of the symbol ids
+  llvm::SmallVector<NodeId, 0> Statements;   // top-level statements in order
+
+  llvm::ArrayRef<uint32_t> getList(uint32_t Offset) const
+  {
+    return llvm::ArrayRef<uint32_t>(Extra).slice(Offset + 1, Extra[Offset]);
+  }
+
+  friend class FlatASTBuilder;
+  friend class FlatSimplifier;
+
+public:
+  // Flatten a parsed tree. The pointer AST is not referenced afterwards, so its
+  // ASTContext may be released once this returns; the symbol table must stay.
+  static FlatAST build(AST *Tree, const SymbolTable &Symbols);
+
+  size_t size() const { return Kinds.size(); }
+  size_t getMemoryUsage() const;
+
+  NodeKind getKind(NodeId N) const { return NodeKind(Kinds[N]); }
+  llvm::ArrayRef<NodeId> getStatements() const { return Statements; }
+  const SymbolTable &getSymbols() const { return *Symbols; }
+
+  int32_t getValue(NodeId N) const { return int32_t(LHS[N]); }
+  uint32_t getSymbol(NodeId N) const { return LHS[N]; }
+
+  BinaryOp::Operator getOperator(NodeId N) const { return BinaryOp::Operator(Ops[N]); }
+  NodeId getLeft(NodeId N) const { return LHS[N]; }
+  NodeId getRight(NodeId N) const { return RHS[N]; }
+
+  NodeId getAssignedValue(NodeId N) const { return RHS[N]; }
+  NodeId getPrinted(NodeId N) const { return LHS[N]; }
+
+  llvm::ArrayRef<uint32_t> getDeclVars(NodeId N) const { return getList(LHS[N]); }
+  llvm::ArrayRef<NodeId> getDeclExprs(NodeId N) const { return getList(RHS[N]); }
+
+  unsigned getNumArms(NodeId N) const { return RHS[N]; }
+  NodeId getArmCondition(NodeId N, unsigned Arm) const { return Extra[LHS[N] + 2 * Arm]; }
+  llvm::ArrayRef<NodeId> getArmBody(NodeId N, unsigned Arm) const { return getList(Extra[LHS[N] + 2 * Arm + 1]); }
+
+  NodeId getLoopCondition(NodeId N) const { return LHS[N]; }
+  llvm::ArrayRef<NodeId> getLoopBody(NodeId N) const { return getList(Extra[RHS[N] + 2]); }
+  LoopHints getLoopHints(NodeId N) const
+  {
+    LoopHints Hints;
+    Hints.Unroll = Extra[RHS[N]];
+    Hints.Vectorize = Extra[RHS[N] + 1];
+    return Hints;
+  }
+
+  // First node of the expression rooted at N.
+  NodeId getSubtreeBegin(NodeId N) const
+  {
+    while (getKind(N) == Binary)
+      N = LHS[N];
+    return N;
+  }
+};
+
+#endif
@@ -1,15 +1,179 @@
+#include "Backend.h"
 #include "CodeGen.h"
+#include "JIT.h"
 #include "Parser.h"
 #include "Sema.h"
+#include "Simplify.h"
+#include "Timing.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/PassTimingInfo.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
-// Define a command-line option for specifying the input expression.
+// Define a command-line option for specifying the input file ("-" reads stdin).
 static llvm::cl::opt<std::string>
-    Input(llvm::cl::Positional,
-          llvm::cl::desc("<input expression>"),
-          llvm::cl::init(""));
+    InputFilename(llvm::cl::Positional,
+                  llvm::cl::desc("<input file>"),
+                  llvm::cl::init("-"));
+
+// Define a command-line option for passing the program text directly.
+static llvm::cl::opt<std::string>
+    InputExpr("e",
+              llvm::cl::desc("Compile the given program text instead of reading a file"),
+              llvm::cl::value_desc("program"));
+
+// Define a command-line option for running the program in-process instead of printing IR.
+static llvm::cl::opt<bool>
+    RunJIT("run",
+           llvm::cl::desc("Compile with the ORC JIT and run main in-process"),
+           llvm::cl::init(false));
+
+// Define a command-line option for lexing the whole input before parsing.
+static llvm::cl::opt<bool>
+    PreLex("prelex",
+           llvm::cl::desc("Lex the whole input into a token stream before parsing"),
+           llvm::cl::init(false));
+
+// Define a command-line option for checking and compiling the compact flat AST.
+static llvm::cl::opt<bool>
+    UseFlatAST("flat-ast",
+               llvm::cl::desc("Flatten the AST into index-based arrays before Sema and CodeGen"),
+               llvm::cl::init(false));
+
+// Define a command-line option for simplifying the AST before code generation.
+static llvm::cl::opt<bool>
+    Fold("fold",
+         llvm::cl::desc("Fold constants and remove dead branches before code generation (default = on)"),
+         llvm::cl::init(true));
+
+// Define a command-line option for sharing identical subexpressions.
+static llvm::cl::opt<bool>
+    HashCons("hash-cons",
+             llvm::cl::desc("Share identical subexpressions in the AST and reuse their values in CodeGen"),
+             llvm::cl::init(false));
+
+// Define a command-line option for emitting variables as SSA values instead of allocas.
+static llvm::cl::opt<bool>
+    UseSSA("ssa",
+           llvm::cl::desc("Build SSA form directly instead of loading and storing allocas"),
+           llvm::cl::init(false));
+
+// Define a command-line option for linking the runtime into the module.
+static llvm::cl::opt<bool>
+    LinkRuntime("link-runtime",
+                llvm::cl::desc("Link the runtime into the module so its calls can be inlined (default = on)"),
+                llvm::cl::init(true));
+
+// Define a command-line option for limiting how many print calls may be inlined.
+static llvm::cl::opt<unsigned>
+    MaxInlinedPrints("max-inlined-prints",
+                     llvm::cl::desc("Number of print calls the inliner may inline with --link-runtime (default = 512)"),
+                     llvm::cl::init(512));
+
+// Define command-line options for the optimisation pipeline run before emitting.
+static llvm::cl::opt<unsigned>
+    OptLevel("O",
+             llvm::cl::desc("Optimization level [-O0, -O1, -O2, -O3] (default = -O0)"),
+             llvm::cl::Prefix,
+             llvm::cl::init(0));
+
+static llvm::cl::opt<std::string>
+    Passes("passes",
+           llvm::cl::desc("Custom new pass manager pipeline, replaces the -O pipeline"),
+           llvm::cl::value_desc("pipeline"));
+
+// Define command-line options for where and in which form the result is written.
+static llvm::cl::opt<std::string>
+    OutputFilename("o",
+                   llvm::cl::desc("Output file (default: IR to stdout)"),
+                   llvm::cl::value_desc("filename"),
+                   llvm::cl::init("-"));
+
+static llvm::cl::opt<Backend::EmitKind>
+    Emit("emit",
+         llvm::cl::desc("Kind of output (default: chosen from the output file extension)"),
+         llvm::cl::values(
+             clEnumValN(Backend::LL, "ll", "Textual LLVM IR"),
+             clEnumValN(Backend::BC, "bc", "LLVM bitcode"),
+             clEnumValN(Backend::Asm, "asm", "Target assembly"),
+             clEnumValN(Backend::Obj, "obj", "Object file"),
+             clEnumValN(Backend::Exe, "exe", "Executable linked with the runtime")));
+
+static llvm::cl::opt<std::string>
+    Runtime("runtime",
+            llvm::cl::desc("Runtime source or library linked into executables"),
+            llvm::cl::value_desc("path"),
+            llvm::cl::init(GSM_RUNTIME_PATH));
+
+// Define command-line options for measuring where the compile time and memory go.
+static llvm::cl::opt<bool>
+    TimeReport("time-report",
+               llvm::cl::desc("Print the time and peak RSS of each phase, and the time of each pass"),
+               llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    TimeTrace("ftime-trace",
+              llvm::cl::desc("Write a Chrome trace of the phases and passes (see -ftime-trace-file)"),
+              llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned>
+    TimeTraceGranularity("ftime-trace-granularity",
+                         llvm::cl::desc("Minimum duration of a traced event in microseconds"),
+                         llvm::cl::init(500));
+
+static llvm::cl::opt<std::string>
+    TimeTraceFile("ftime-trace-file",
+                  llvm::cl::desc("Trace file (default: <output>.time-trace, or gsm.time-trace for stdout)"),
+                  llvm::cl::value_desc("filename"));
+
+namespace
+{
+    // --stats and --stats-json are LLVM's own options, backed by plain bools in
+    // the Support library. The LLVM libraries are built without statistics and
+    // would only print a notice at exit, so the driver takes the flags over and
+    // prints the compiler's counters itself.
+    llvm::cl::Option *findOption(llvm::StringRef Name)
+    {
+        llvm::StringMap<llvm::cl::Option *> &Options = llvm::cl::getRegisteredOptions();
+        auto It = Options.find(Name);
+        return It == Options.end() ? nullptr : It->second;
+    }
+
+    bool isOptionGiven(llvm::StringRef Name)
+    {
+        llvm::cl::Option *Opt = findOption(Name);
+        return Opt && Opt->getNumOccurrences();
+    }
+
+    bool PrintStats = false;
+    bool PrintStatsJSON = false;
+
+    // Print the time report and write the trace when main returns, also when
+    // a phase fails, so the phase that went wrong can still be seen.
+    struct ReportOnExit
+    {
+        ~ReportOnExit()
+        {
+            PhaseTimer::printReport(llvm::errs());
+            if (PrintStats)
+            {
+                std::unique_ptr<llvm::raw_fd_ostream> OS = llvm::CreateInfoOutputFile();
+                if (PrintStatsJSON)
+                    llvm::PrintStatisticsJSON(*OS);
+                else
+                    llvm::PrintStatistics(*OS);
+            }
+            if (!llvm::timeTraceProfilerEnabled())
+                return;
+            if (llvm::Error Err = llvm::timeTraceProfilerWrite(
+                    TimeTraceFile, OutputFilename == "-" ? "gsm" : OutputFilename.getValue()))
+                llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "Could not write time trace: ");
+            llvm::timeTraceProfilerCleanup();
+        }
+    };
+}
 
 // The main function of the program.
 int main(int argc, const char **argv)
@@ -20,14 +184,81 @@ int main(int argc, const char **argv)
     // Parse command-line options.
     llvm::cl::ParseCommandLineOptions(argc, argv, "GSM - the expression compiler\n");
 
-    // Create a lexer object and initialize it with the input expression.
-    Lexer Lex(Input);
+    // The flat AST expands shared nodes into a tree again and its CodeGen keeps
+    // no values across nodes, so sharing would only cost parse time.
+    bool ShareExprs = HashCons;
+    if (ShareExprs && UseFlatAST)
+    {
+        llvm::errs() << "warning: --hash-cons has no effect with --flat-ast, which expands shared expressions\n";
+        ShareExprs = false;
+    }
+
+    // Set up the time report and trace before the first phase starts.
+    if (TimeReport)
+    {
+        PhaseTimer::enableReport();
+        llvm::TimePassesIsEnabled = true;
+    }
+    if (TimeTrace)
+        llvm::timeTraceProfilerInitialize(TimeTraceGranularity, argv[0]);
+    PrintStatsJSON = isOptionGiven("stats-json");
+    PrintStats = isOptionGiven("stats") || PrintStatsJSON;
+    if (PrintStats)
+    {
+        llvm::EnableStatistics(/*DoPrintOnExit=*/false);
+        // LLVM prints its notice at exit while --stats is set, so clear the
+        // flag by parsing a value for it as if given once more. MultiArg keeps
+        // that from counting as a second occurrence of the option.
+        if (llvm::cl::Option *Stats = findOption("stats"))
+            Stats->addOccurrence(0, "stats", "false", /*MultiArg=*/true);
+    }
+    ReportOnExit Report;
+
+    // Load the input. Files are memory-mapped when possible and the lexer
+    // runs directly over the mapped pages, so no null terminator is needed.
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    if (InputExpr.getNumOccurrences())
+        Buffer = llvm::MemoryBuffer::getMemBuffer(InputExpr, "<command line>",
+                                                  /*RequiresNullTerminator=*/false);
+    else
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> FileOrErr =
+            llvm::MemoryBuffer::getFileOrSTDIN(InputFilename, /*IsText=*/false,
+                                               /*RequiresNullTerminator=*/false);
+        if (std::error_code EC = FileOrErr.getError())
+        {
+            llvm::errs() << "Could not open " << InputFilename << ": "
+                         << EC.message() << "\n";
+            return 1;
+        }
+        Buffer = std::move(*FileOrErr);
+    }
+
+    // Create a lexer object and initialize it with the input buffer.
+    Lexer Lex(Buffer->getBuffer());
 
-    // Create a parser object and initialize it with the lexer.
-    Parser Parser(Lex);
+    // Create a parser object and initialize it with the lexer, or with the
+    // token stream when lexing up front. All AST nodes live in the context
+    // and are freed together when main returns.
+    ASTContext Context;
+    TokenStream Tokens;
+    bool UseTokens = false;
+    if (PreLex)
+    {
+        // A buffer too large for the token stream is lexed on demand instead.
+        PhaseTimer Timer("lex", "Lexing");
+        UseTokens = !Lex.lexAll(Tokens);
+    }
+    Parser Parser = UseTokens ? ::Parser(Tokens, Context) : ::Parser(Lex, Context);
+    Parser.setHashConsing(ShareExprs);
 
     // Parse the input expression and generate an abstract syntax tree (AST).
-    AST *Tree = Parser.parse();
+    // Without --prelex the lexer runs on demand, so its time counts as parsing.
+    AST *Tree;
+    {
+        PhaseTimer Timer("parse", UseTokens ? "Parsing" : "Lexing and parsing");
+        Tree = Parser.parse();
+    }
 
     // Check if parsing was successful or if there were any syntax errors.
     if (!Tree || Parser.hasError())
@@ -36,17 +267,74 @@ int main(int argc, const char **argv)
         return 1;
     }
 
+    // Optionally switch to the flat representation and drop the node graph.
+    FlatAST Flat;
+    if (UseFlatAST)
+    {
+        PhaseTimer Timer("flatten", "Flattening the AST");
+        Flat = FlatAST::build(Tree, Context.getSymbols());
+        Context.reset();
+        Tree = nullptr;
+    }
+
     // Perform semantic analysis on the AST.
     Sema Semantic;
-    if (Semantic.semantic(Tree))
+    bool SemaFailed;
+    {
+        PhaseTimer Timer("sema", "Semantic analysis");
+        SemaFailed = UseFlatAST ? Semantic.semantic(Flat) : Semantic.semantic(Tree, Context.getSymbols());
+    }
+    if (SemaFailed)
     {
         llvm::errs() << "Semantic errors occurred\n";
         return 1;
     }
 
+    // Fold constants and drop dead code while it is still cheap, before any IR exists.
+    if (Fold)
+    {
+        PhaseTimer Timer("simplify", "Simplification");
+        Simplify Simplifier;
+        if (UseFlatAST)
+            Flat = Simplifier.simplify(Flat);
+        else
+            Tree = Simplifier.simplify(Tree, Context);
+    }
+
+    if (OptLevel > 3)
+    {
+        llvm::errs() << "Invalid optimization level -O" << OptLevel << "\n";
+        return 1;
+    }
+
+    // Set up the target first so the optimiser knows what it is optimising for.
+    Backend Target(Runtime);
+    if (Target.initTarget(OptLevel))
+        return 1;
+
     // Generate code for the AST using a code generator.
-    CodeGen CodeGenerator;
-    CodeGenerator.compile(Tree);
+    auto Ctx = std::make_unique<llvm::LLVMContext>();
+    CodeGen CodeGenerator(Target.getTargetMachine(), OptLevel, Passes, UseSSA, LinkRuntime,
+                          MaxInlinedPrints);
+    std::unique_ptr<llvm::Module> M;
+    {
+        PhaseTimer Timer("codegen", "Code generation");
+        M = UseFlatAST ? CodeGenerator.compile(Flat, *Ctx)
+                       : CodeGenerator.compile(Tree, Context.getSymbols(), *Ctx);
+    }
+    if (!M)
+        return 1;
+
+    // Either run the module right away or print it for llc.
+    if (RunJIT)
+    {
+        JIT Engine;
+        return Engine.run(std::move(M), std::move(Ctx));
+    }
+    Backend::EmitKind Kind = Emit.getNumOccurrences() ? Emit.getValue()
+                                                      : Backend::kindForOutput(OutputFilename);
+    if (Target.emit(*M, Kind, OutputFilename))
+        return 1;
 
     // The program executed successfully.
     return 0;
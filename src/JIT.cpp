@@ -0,0 +1,108 @@
+#include "JIT.h"
+#include "Timing.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include <csignal>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// The runtime functions from rtGSM.c, linked into the gsm executable.
+extern "C"
+{
+  void print(int v);
+  void gsm_print_n(const int *v, int n);
+  void gsm_flush(void);
+  int gsm_read(char *s);
+}
+
+namespace
+{
+  // Report an ORC error and return the exit code for a failed run.
+  int fail(Error Err)
+  {
+    logAllUnhandledErrors(std::move(Err), errs(), "JIT error: ");
+    return 1;
+  }
+
+  // A division that traps in the generated code ends the run with a plain
+  // message instead of LLVM's crash report, and with the status a shell
+  // reports for a process killed by SIGFPE.
+  void onArithmeticTrap(int)
+  {
+    static const char Msg[] = "Runtime error: division by zero or overflow\n";
+    ssize_t Written = write(2, Msg, sizeof(Msg) - 1);
+    (void)Written;
+    _exit(128 + SIGFPE);
+  }
+}
+
+int JIT::run(std::unique_ptr<Module> M, std::unique_ptr<LLVMContext> Ctx)
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  // Time everything up to the lookup of main, which compiles the module.
+  Optional<PhaseTimer> Timer;
+  Timer.emplace("jit", "JIT compilation");
+
+  auto JOrErr = LLJITBuilder().create();
+  if (!JOrErr)
+    return fail(JOrErr.takeError());
+  std::unique_ptr<LLJIT> J = std::move(*JOrErr);
+
+  // Resolve the runtime calls to the copies already in this process instead
+  // of searching for them in a separately compiled rtGSM object, unless the
+  // runtime was linked into the module and it has its own.
+  const std::pair<const char *, JITTargetAddress> Natives[] = {
+      {"print", pointerToJITTargetAddress(&print)},
+      {"gsm_print_n", pointerToJITTargetAddress(&gsm_print_n)},
+      {"gsm_read", pointerToJITTargetAddress(&gsm_read)}};
+  JITSymbolFlags Flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+  SymbolMap Runtime;
+  for (const auto &Native : Natives)
+  {
+    Function *F = M->getFunction(Native.first);
+    if (!F || F->isDeclaration())
+      Runtime[J->mangleAndIntern(Native.first)] = JITEvaluatedSymbol(Native.second, Flags);
+  }
+  if (!Runtime.empty())
+    if (Error Err = J->getMainJITDylib().define(absoluteSymbols(std::move(Runtime))))
+      return fail(std::move(Err));
+  // A linked runtime writes its output out before main returns.
+  Function *Flush = M->getFunction("gsm_flush");
+  bool OwnOutput = Flush && !Flush->isDeclaration();
+
+  // A runtime linked into the module calls into the C library of this process.
+  auto LibC = DynamicLibrarySearchGenerator::GetForCurrentProcess(J->getDataLayout().getGlobalPrefix());
+  if (!LibC)
+    return fail(LibC.takeError());
+  J->getMainJITDylib().addGenerator(std::move(*LibC));
+
+  if (Error Err = J->addIRModule(ThreadSafeModule(std::move(M), std::move(Ctx))))
+    return fail(std::move(Err));
+
+  auto MainOrErr = J->lookup("main");
+  if (!MainOrErr)
+    return fail(MainOrErr.takeError());
+  Timer.reset();
+
+  // Run the generated main with the same signature the AOT binary has.
+  auto *Main = jitTargetAddressToFunction<int (*)(int, char **)>(MainOrErr->getAddress());
+  char ProgName[] = "gsm";
+  char *Argv[] = {ProgName, nullptr};
+  struct sigaction Trap = {}, Saved;
+  Trap.sa_handler = onArithmeticTrap;
+  sigaction(SIGFPE, &Trap, &Saved);
+  int ExitCode = Main(1, Argv);
+  sigaction(SIGFPE, &Saved, nullptr);
+
+  // The runtime buffers its output until the gsm process exits; write it out
+  // now so it comes before anything the driver prints afterwards.
+  if (!OwnOutput)
+    gsm_flush();
+  return ExitCode;
+}
@@ -0,0 +1,15 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+class JIT
+{
+public:
+  // Compile the module in-process with ORC and run its main function.
+  // Returns the exit code of main, or 1 if the module could not be run. A
+  // division that traps exits the process with status 136.
+  int run(std::unique_ptr<llvm::Module> M, std::unique_ptr<llvm::LLVMContext> Ctx);
+};
+#endif
@@ -1,46 +1,234 @@
 #include "Lexer.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define DEBUG_TYPE "lexer"
+
+ALWAYS_ENABLED_STATISTIC(NumComments, "Number of comments skipped");
+ALWAYS_ENABLED_STATISTIC(NumPreLexed, "Number of tokens lexed up front");
+
 // classifying characters
 namespace charinfo
 {
+    enum CharClass : unsigned char
+    {
+        WS = 1, // whitespace
+        DG = 2, // digit
+        LT = 4, // letter
+        SP = 8  // first character of an operator or punctuation
+    };
+
+    // class of every byte value, so each test below is a single load
+    const unsigned char CharClasses[256] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, WS, WS, WS, WS, WS, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        WS, SP, 0, 0, 0, SP, 0, 0, SP, SP, SP, SP, SP, SP, 0, SP,
+        DG, DG, DG, DG, DG, DG, DG, DG, DG, DG, SP, SP, SP, SP, SP, 0,
+        0, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT,
+        LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, 0, 0, 0, SP, 0,
+        0, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT,
+        LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, LT, 0, 0, 0, 0, 0,
+        // 0x80 - 0xFF: non-ASCII bytes are never part of a token
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    };
+
     // ignore whitespaces
     LLVM_READNONE inline bool isWhitespace(char c)
     {
-        return c == ' ' || c == '\t' || c == '\f' || c == '\v' ||
-               c == '\r' || c == '\n';
+        return CharClasses[(unsigned char)c] & WS;
     }
 
     LLVM_READNONE inline bool isDigit(char c)
     {
-        return c >= '0' && c <= '9';
+        return CharClasses[(unsigned char)c] & DG;
     }
 
     LLVM_READNONE inline bool isLetter(char c)
     {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        return CharClasses[(unsigned char)c] & LT;
     }
 
     LLVM_READNONE inline bool isSpecialCharacter(char c)
     {
-        return c == '=' || c == '+' || c == '-' || c == '*' || c == '/' || c == '!' || c == '>' || c == '<' || c == '(' || c == ')' || c == ',' || c == ';' || c == '%' || c == '^' || c == ':';
+        return CharClasses[(unsigned char)c] & SP;
+    }
+}
+
+// vectorised scanning of character runs: each kernel returns a bit mask with
+// bit i set if byte i of the block belongs to the run
+namespace simd
+{
+#if defined(__AVX2__)
+    constexpr ptrdiff_t Width = 32;
+    using Vec = __m256i;
+
+    inline Vec load(const char *P) { return _mm256_loadu_si256((const __m256i *)P); }
+    inline Vec splat(char C) { return _mm256_set1_epi8(C); }
+    inline Vec eq(Vec A, Vec B) { return _mm256_cmpeq_epi8(A, B); }
+    inline Vec sub(Vec A, Vec B) { return _mm256_sub_epi8(A, B); }
+    inline Vec either(Vec A, Vec B) { return _mm256_or_si256(A, B); }
+    inline Vec both(Vec A, Vec B) { return _mm256_and_si256(A, B); }
+    inline Vec umin(Vec A, Vec B) { return _mm256_min_epu8(A, B); }
+    inline uint32_t mask(Vec V) { return (uint32_t)_mm256_movemask_epi8(V); }
+#elif defined(__SSE2__)
+    constexpr ptrdiff_t Width = 16;
+    using Vec = __m128i;
+
+    inline Vec load(const char *P) { return _mm_loadu_si128((const __m128i *)P); }
+    inline Vec splat(char C) { return _mm_set1_epi8(C); }
+    inline Vec eq(Vec A, Vec B) { return _mm_cmpeq_epi8(A, B); }
+    inline Vec sub(Vec A, Vec B) { return _mm_sub_epi8(A, B); }
+    inline Vec either(Vec A, Vec B) { return _mm_or_si128(A, B); }
+    inline Vec both(Vec A, Vec B) { return _mm_and_si128(A, B); }
+    inline Vec umin(Vec A, Vec B) { return _mm_min_epu8(A, B); }
+    inline uint32_t mask(Vec V) { return (uint32_t)_mm_movemask_epi8(V); }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    // Lo <= V - Base <= Lo + Count in unsigned arithmetic, i.e. Base <= V <= Base + Count
+    inline Vec inRange(Vec V, char Base, char Count)
+    {
+        Vec Off = sub(V, splat(Base));
+        return eq(umin(Off, splat(Count)), Off);
+    }
+
+    inline uint32_t whitespace(const char *P)
+    {
+        Vec V = load(P);
+        return mask(either(eq(V, splat(' ')), inRange(V, '\t', '\r' - '\t')));
+    }
+
+    inline uint32_t letters(const char *P)
+    {
+        return mask(inRange(either(load(P), splat(0x20)), 'a', 'z' - 'a'));
+    }
+
+    inline uint32_t digits(const char *P)
+    {
+        return mask(inRange(load(P), '0', 9));
+    }
+
+    // bit i is set if "*/" starts at byte i; reads Width + 1 bytes
+    inline uint32_t commentEnds(const char *P)
+    {
+        return mask(both(eq(load(P), splat('*')), eq(load(P + 1), splat('/'))));
+    }
+#endif
+}
+
+namespace
+{
+    // skip the run of characters accepted by IsInRun, a block at a time while
+    // a whole vector fits in the buffer and byte by byte for the tail
+    template <uint32_t (*BlockMask)(const char *), bool (*IsInRun)(char)>
+    inline const char *skipRun(const char *Ptr, const char *End)
+    {
+#if defined(__AVX2__) || defined(__SSE2__)
+        while (End - Ptr >= simd::Width) {
+            // the mask is built in 64 bits, as shifting a uint32_t by a Width
+            // of 32 would overflow
+            uint32_t Outside = ~BlockMask(Ptr) & uint32_t((uint64_t(1) << simd::Width) - 1);
+            if (Outside)
+                return Ptr + llvm::countTrailingZeros(Outside);
+            Ptr += simd::Width;
+        }
+#endif
+        while (Ptr != End && IsInRun(*Ptr))
+            ++Ptr;
+        return Ptr;
+    }
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    inline const char *skipWhitespace(const char *Ptr, const char *End)
+    {
+        return skipRun<simd::whitespace, charinfo::isWhitespace>(Ptr, End);
+    }
+
+    inline const char *skipLetters(const char *Ptr, const char *End)
+    {
+        return skipRun<simd::letters, charinfo::isLetter>(Ptr, End);
+    }
+
+    inline const char *skipDigits(const char *Ptr, const char *End)
+    {
+        return skipRun<simd::digits, charinfo::isDigit>(Ptr, End);
+    }
+#else
+    inline uint32_t noSIMD(const char *) { return 0; }
+
+    inline const char *skipWhitespace(const char *Ptr, const char *End)
+    {
+        return skipRun<noSIMD, charinfo::isWhitespace>(Ptr, End);
+    }
+
+    inline const char *skipLetters(const char *Ptr, const char *End)
+    {
+        return skipRun<noSIMD, charinfo::isLetter>(Ptr, End);
+    }
+
+    inline const char *skipDigits(const char *Ptr, const char *End)
+    {
+        return skipRun<noSIMD, charinfo::isDigit>(Ptr, End);
+    }
+#endif
+
+    // find the "*/" closing a comment, or return End if there is none
+    inline const char *findCommentEnd(const char *Ptr, const char *End)
+    {
+#if defined(__AVX2__) || defined(__SSE2__)
+        while (End - Ptr > simd::Width) {
+            if (uint32_t Found = simd::commentEnds(Ptr))
+                return Ptr + llvm::countTrailingZeros(Found);
+            Ptr += simd::Width;
+        }
+#endif
+        for (; End - Ptr >= 2; ++Ptr)
+            if (Ptr[0] == '*' && Ptr[1] == '/')
+                return Ptr;
+        return End;
     }
 }
 
 void Lexer::next(Token &token) {
-    while (*BufferPtr && charinfo::isWhitespace(*BufferPtr)) {
-        ++BufferPtr;
+    // skip whitespace and comments; comment bodies never reach the parser
+    while (true) {
+        BufferPtr = skipWhitespace(BufferPtr, BufferEnd);
+        if (BufferEnd - BufferPtr < 2 || BufferPtr[0] != '/' || BufferPtr[1] != '*')
+            break;
+        const char *CommentEnd = findCommentEnd(BufferPtr + 2, BufferEnd);
+        if (CommentEnd == BufferEnd) {
+            // report the unterminated comment at its start and drop the rest
+            token.Kind = Token::start_comment;
+            token.Text = llvm::StringRef(BufferPtr, 2);
+            BufferPtr = BufferEnd;
+            return;
+        }
+        BufferPtr = CommentEnd + 2;
+        ++CommentsSkipped;
     }
     // make sure we didn't reach the end of input
-    if (!*BufferPtr) {
+    if (BufferPtr == BufferEnd) {
+        NumComments += CommentsSkipped;
+        CommentsSkipped = 0;
         token.Kind = Token::eoi;
+        token.Text = llvm::StringRef(BufferEnd, 0);
         return;
     }
     // collect characters and check for keywords or ident
     if (charinfo::isLetter(*BufferPtr)) {
-        const char *end = BufferPtr + 1;
-        while (charinfo::isLetter(*end))
-            ++end;
+        const char *end = skipLetters(BufferPtr + 1, BufferEnd);
         llvm::StringRef Name(BufferPtr, end - BufferPtr);
         Token::TokenKind kind;
         if (Name == "int")
@@ -69,127 +257,11 @@ void Lexer::next(Token &token) {
         formToken(token, end, kind);
         return;
     } else if (charinfo::isDigit(*BufferPtr)) { // check for numbers
-        const char *end = BufferPtr + 1;
-        while (charinfo::isDigit(*end))
-            ++end;
+        const char *end = skipDigits(BufferPtr + 1, BufferEnd);
         formToken(token, end, Token::number);
         return;
     } else if (charinfo::isSpecialCharacter(*BufferPtr)) {
-        const char *endWithOneLetter = BufferPtr + 1;
-        const char *endWithTwoLetter = BufferPtr + 2;
-        const char *end;
-        llvm::StringRef NameWithOneLetter(BufferPtr, endWithOneLetter - BufferPtr);
-        llvm::StringRef NameWithTwoLetter(BufferPtr, endWithTwoLetter - BufferPtr);
-        Token::TokenKind kind;
-        bool isFound = false;
-        if (NameWithTwoLetter == "=="){
-            kind = Token::double_equal;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithOneLetter == "=") {
-            kind = Token::equal;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithTwoLetter == "!="){
-            kind = Token::not_equal;
-            isFound = true;
-            end = endWithTwoLetter;
-        }else if (NameWithTwoLetter == "+="){
-            kind = Token::equal_plus;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "-="){
-            kind = Token::equal_minus;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "*="){
-            kind = Token::equal_star;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "*/"){
-            kind = Token::end_comment;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "/="){
-            kind = Token::equal_slash;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "/*"){
-            kind = Token::start_comment;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "%="){
-            kind = Token::equal_mod;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == ">="){
-            kind = Token::greater_equal;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithTwoLetter == "<="){
-            kind = Token::lower_equal;
-            isFound = true;
-            end = endWithTwoLetter;
-        } else if (NameWithOneLetter == "+"){
-            kind = Token::plus;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "-"){
-            kind = Token::minus;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "*"){
-            kind = Token::star;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "/"){
-            kind = Token::slash;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "+"){
-            kind = Token::plus;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ">"){
-            kind = Token::greater;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "<"){
-            kind = Token::lower;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "("){
-            kind = Token::l_paren;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ")"){
-            kind = Token::r_paren;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ";"){
-            kind = Token::semicolon;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ","){
-            kind = Token::comma;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "%"){
-            kind = Token::module;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == "^"){
-            kind = Token::power;
-            isFound = true;
-            end = endWithOneLetter;
-        } else if (NameWithOneLetter == ":"){
-            kind = Token::colon;
-            isFound = true;
-            end = endWithOneLetter;
-        }
-        // generate the token
-        if (isFound) formToken(token, end, kind);
-        else formToken(token, BufferPtr + 1, Token::unknown);
+        formOperator(token);
         return;
     } else {
         formToken(token, BufferPtr + 1, Token::unknown); 
@@ -198,6 +270,64 @@ void Lexer::next(Token &token) {
     return;
 }
 
+bool Lexer::lexAll(TokenStream &Stream)
+{
+    if (uint64_t(BufferEnd - BufferStart) >= TokenStream::MaxBufferSize)
+        return true;
+    Stream.Buffer = llvm::StringRef(BufferStart, BufferEnd - BufferStart);
+    // on typical sources a token takes about four bytes including whitespace
+    size_t Estimate = (BufferEnd - BufferPtr) / 4 + 1;
+    Stream.Kinds.reserve(Estimate);
+    Stream.Offsets.reserve(Estimate);
+    Stream.Lengths.reserve(Estimate);
+
+    Token Tok;
+    do {
+        next(Tok);
+        Stream.Kinds.push_back(Tok.Kind);
+        Stream.Offsets.push_back(Tok.Text.data() - BufferStart);
+        Stream.Lengths.push_back(Tok.Text.size());
+    } while (Tok.Kind != Token::eoi);
+    NumPreLexed += Stream.size();
+    return false;
+}
+
+// the first character selects the candidates, the second one (if any) decides
+// between the one- and two-character operator
+void Lexer::formOperator(Token &Tok)
+{
+    char Next = BufferEnd - BufferPtr >= 2 ? BufferPtr[1] : '\0';
+    auto oneOrTwo = [&](char Second, Token::TokenKind Two, Token::TokenKind One) {
+        if (Next == Second)
+            formToken(Tok, BufferPtr + 2, Two);
+        else
+            formToken(Tok, BufferPtr + 1, One);
+    };
+
+    switch (*BufferPtr) {
+    case '=': return oneOrTwo('=', Token::double_equal, Token::equal);
+    case '!': return oneOrTwo('=', Token::not_equal, Token::unknown);
+    case '+': return oneOrTwo('=', Token::equal_plus, Token::plus);
+    case '-': return oneOrTwo('=', Token::equal_minus, Token::minus);
+    case '%': return oneOrTwo('=', Token::equal_mod, Token::module);
+    case '>': return oneOrTwo('=', Token::greater_equal, Token::greater);
+    case '<': return oneOrTwo('=', Token::lower_equal, Token::lower);
+    case '*':
+        if (Next == '/')
+            return formToken(Tok, BufferPtr + 2, Token::end_comment);
+        return oneOrTwo('=', Token::equal_star, Token::star);
+    case '/':
+        return oneOrTwo('=', Token::equal_slash, Token::slash);
+    case '(': return formToken(Tok, BufferPtr + 1, Token::l_paren);
+    case ')': return formToken(Tok, BufferPtr + 1, Token::r_paren);
+    case ';': return formToken(Tok, BufferPtr + 1, Token::semicolon);
+    case ',': return formToken(Tok, BufferPtr + 1, Token::comma);
+    case '^': return formToken(Tok, BufferPtr + 1, Token::power);
+    case ':': return formToken(Tok, BufferPtr + 1, Token::colon);
+    default: return formToken(Tok, BufferPtr + 1, Token::unknown);
+    }
+}
+
 void Lexer::formToken(Token &Tok, const char *TokEnd,
                       Token::TokenKind Kind)
 {
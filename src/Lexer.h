@@ -1,14 +1,17 @@
 #ifndef LEXER_H // conditional compilations(checks whether a macro is not defined)
 #define LEXER_H
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"        // encapsulates a pointer to a C string and its length
 #include "llvm/Support/MemoryBuffer.h" // read-only access to a block of memory, filled with the content of a file
 
 class Lexer;
+class TokenStream;
 
 class Token
 {
     friend class Lexer; // Lexer can access private and protected members of Token
+    friend class TokenStream;
 
 public:
     enum TokenKind : unsigned short
@@ -53,8 +56,10 @@ public:
         equal_slash,
         equal_mod,
 
-        start_comment,
-        end_comment
+        start_comment, // "/*" without a matching "*/"; closed comments are skipped
+        end_comment,
+
+        NUM_TOKENS // number of token kinds, not a real token
     };
 
 private:
@@ -76,21 +81,66 @@ public:
         const { return is(K1) || isOneOf(K2, Ks...); }
 };
 
+// TokenStream holds a whole buffer lexed up front, one entry per token in
+// parallel arrays, and always ends with an eoi token. Tokens are addressed by
+// index, so any amount of lookahead is a couple of loads. Offsets are 32-bit,
+// so the buffer must be smaller than MaxBufferSize.
+class TokenStream
+{
+    friend class Lexer;
+
+    llvm::StringRef Buffer;
+    llvm::SmallVector<uint8_t, 0> Kinds;
+    llvm::SmallVector<uint32_t, 0> Offsets; // byte offset of the token in Buffer
+    llvm::SmallVector<uint32_t, 0> Lengths;
+
+public:
+    static constexpr uint64_t MaxBufferSize = uint64_t(1) << 32;
+
+    size_t size() const { return Kinds.size(); }
+    llvm::StringRef getBuffer() const { return Buffer; }
+
+    Token::TokenKind getKind(size_t I) const { return Token::TokenKind(Kinds[I]); }
+    uint32_t getOffset(size_t I) const { return Offsets[I]; }
+    llvm::StringRef getText(size_t I) const { return Buffer.substr(Offsets[I], Lengths[I]); }
+
+    // fill Tok with token I; indices past the end read the final eoi
+    void get(size_t I, Token &Tok) const
+    {
+        if (I >= Kinds.size())
+            I = Kinds.size() - 1;
+        Tok.Kind = getKind(I);
+        Tok.Text = getText(I);
+    }
+};
+
 class Lexer
 {
     const char *BufferStart; // pointer to the beginning of the input
+    const char *BufferEnd;   // pointer one past the last character of the input
     const char *BufferPtr;   // pointer to the next unprocessed character
+    unsigned CommentsSkipped = 0; // for --stats, added up at the end of input
 
 public:
+    // the buffer is only referenced, never copied, and does not need to be
+    // null-terminated (e.g. a memory-mapped file)
     Lexer(const llvm::StringRef &Buffer)
     {
         BufferStart = Buffer.begin();
+        BufferEnd = Buffer.end();
         BufferPtr = BufferStart;
     }
 
     void next(Token &token); // return the next token
 
+    // lex everything that is left into Stream, including the final eoi;
+    // returns true, leaving Stream empty, if the buffer is too large for it
+    bool lexAll(TokenStream &Stream);
+
+    const char *getBufferStart() const { return BufferStart; }
+
 private:
     void formToken(Token &Result, const char *TokEnd, Token::TokenKind Kind);
+    void formOperator(Token &Result);
 };
 #endif
\ No newline at end of file
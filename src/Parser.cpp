@@ -1,9 +1,97 @@
 #include "Parser.h"
+#include "llvm/ADT/Statistic.h"
+
+#define DEBUG_TYPE "parser"
+
+ALWAYS_ENABLED_STATISTIC(NumTokens, "Number of tokens read by the parser");
+ALWAYS_ENABLED_STATISTIC(NumFactors, "Number of identifier and number nodes");
+ALWAYS_ENABLED_STATISTIC(NumBinaryOps, "Number of binary operator nodes");
+ALWAYS_ENABLED_STATISTIC(NumAssignments, "Number of assignment nodes");
+ALWAYS_ENABLED_STATISTIC(NumDeclarations, "Number of declaration nodes");
+ALWAYS_ENABLED_STATISTIC(NumIfElses, "Number of if/elif/else nodes");
+ALWAYS_ENABLED_STATISTIC(NumLoops, "Number of loop nodes");
+ALWAYS_ENABLED_STATISTIC(NumPrints, "Number of print nodes");
+ALWAYS_ENABLED_STATISTIC(NumSharedExprs, "Number of expressions shared by hash-consing");
+
+namespace
+{
+    // counts the nodes of each kind, walked only when statistics are enabled
+    class NodeCounter : public ASTVisitor<NodeCounter>
+    {
+    public:
+        using ASTVisitor<NodeCounter>::visit; // factors have no children
+
+        unsigned Counts[AST::AK_Print + 1] = {};
+
+        void count(AST *Node)
+        {
+            ++Counts[Node->getKind()];
+            Node->accept(*this);
+        }
+
+        void count(llvm::ArrayRef<Assignment *> Body)
+        {
+            for (Assignment *A : Body)
+                count(A);
+        }
+
+        void visit(GSM &Node)
+        {
+            for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+                count(*I);
+        }
+
+        void visit(BinaryOp &Node)
+        {
+            count(Node.getLeft());
+            count(Node.getRight());
+        }
+
+        void visit(Assignment &Node) { count(Node.getRight()); }
+
+        void visit(Declaration &Node)
+        {
+            for (auto I = Node.begin_exprs(), E = Node.end_exprs(); I != E; ++I)
+                count(*I);
+        }
+
+        void visit(Print &Node) { count(Node.getExpr()); }
+
+        void visit(IfElse &Node)
+        {
+            for (Expr *Cond : Node.getConditions())
+                count(Cond);
+            for (llvm::ArrayRef<Assignment *> Body : Node.getAssignments())
+                count(Body);
+        }
+
+        void visit(Loop &Node)
+        {
+            count(Node.getCondition());
+            count(Node.getAssignments());
+        }
+    };
+}
 
 // main point is that the whole input has been consumed
 AST *Parser::parse()
 {
     AST *Res = parseGSM();
+
+    NumTokens += TokensRead;
+    NumSharedExprs += NumShared;
+    if (Res && llvm::AreStatisticsEnabled())
+    {
+        NodeCounter Counter;
+        Res->accept(Counter);
+        NumFactors += Counter.Counts[AST::AK_Factor];
+        NumBinaryOps += Counter.Counts[AST::AK_BinaryOp];
+        NumAssignments += Counter.Counts[AST::AK_Assignment];
+        NumDeclarations += Counter.Counts[AST::AK_Declaration];
+        NumIfElses += Counter.Counts[AST::AK_IfElse];
+        NumLoops += Counter.Counts[AST::AK_Loop];
+        NumPrints += Counter.Counts[AST::AK_Print];
+    }
     return Res;
 }
 
@@ -59,18 +147,13 @@ AST *Parser::parseGSM()
                     exprs.push_back(d);
                 } else error();
                 break;
-            case Token::start_comment:
-                parseComment();
-                if (!Tok.is(Token::end_comment))
-                    error();
-                advance();
-                break;
             default:
                 error();
+                advance(); // skip the offending token so parsing makes progress
                 break;
         }
     }
-    return new GSM(exprs);
+    return new (Ctx) GSM(Ctx.copy<Expr *>(exprs));
 
 _error2:
     while (Tok.getKind() != Token::eoi)
@@ -83,7 +166,7 @@ Expr *Parser::parseDec()
     Expr *E;
     int count_vars = 0;
     int count_exprs = 0;
-    llvm::SmallVector<llvm::StringRef, 8> Vars;
+    llvm::SmallVector<uint32_t, 8> Vars;
     llvm::SmallVector<Expr *, 8> Exprs;
     if (expect(Token::KW_int)) {
         error();
@@ -98,7 +181,7 @@ Expr *Parser::parseDec()
         goto _error;
     }
 
-    Vars.push_back(Tok.getText());
+    Vars.push_back(Ctx.getSymbols().intern(Tok.getText()));
     advance();
 
     while (Tok.is(Token::comma))
@@ -109,7 +192,7 @@ Expr *Parser::parseDec()
             goto _error;
         }
 
-        Vars.push_back(Tok.getText());
+        Vars.push_back(Ctx.getSymbols().intern(Tok.getText()));
         count_vars++;
         advance();
     }
@@ -135,7 +218,7 @@ Expr *Parser::parseDec()
     }
 
 
-    return new Declaration(Vars, Exprs);
+    return new (Ctx) Declaration(Ctx.copy<uint32_t>(Vars), Ctx.copy<Expr *>(Exprs));
 _error: // TODO: Check this later in case of error :)
     while (Tok.getKind() != Token::eoi)
         advance();
@@ -162,7 +245,7 @@ Expr *Parser::parsePrint()
     }
     advance();
 
-    return new Print(E);
+    return new (Ctx) Print(E);
 _error: // TODO: Check this later in case of error :)
     while (Tok.getKind() != Token::eoi)
         advance();
@@ -195,116 +278,131 @@ Assignment *Parser::parseAssign()
 
     advance();
     E = parseExpr();
-    return new Assignment(F, E, T);
-}
-
-Expr *Parser::parseExpr()
-{
-    Expr *Left = parseExpr1();
-    while (Tok.is(Token::orc))
-    {
-        BinaryOp::Operator Op = BinaryOp::Or;
-        advance();
-        Expr *Right = parseExpr1();
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
-}
-
-Expr *Parser::parseExpr1()
-{
-    Expr *Left = parseExpr2();
-    while (Tok.is(Token::andc))
-    {
-        BinaryOp::Operator Op = BinaryOp::And;
-        advance();
-        Expr *Right = parseExpr2();
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
-}
 
-Expr *Parser::parseExpr2()
-{
-    Expr *Left = parseExpr3();
-    while (Tok.isOneOf(Token::double_equal, Token::not_equal))
-    {
-        BinaryOp::Operator Op =
-            Tok.is(Token::double_equal) ? BinaryOp::DoubleEqual : BinaryOp::NotEqual;
-        advance();
-        Expr *Right = parseExpr3();
-        Left = new BinaryOp(Op, Left, Right);
+    // expand compound assignments once here, e.g. a += b is stored as a = a + b
+    switch (T) {
+        case Assignment::Type::EqualPlus:
+            E = makeBinary(BinaryOp::Plus, F, E);
+            break;
+        case Assignment::Type::EqualMinus:
+            E = makeBinary(BinaryOp::Minus, F, E);
+            break;
+        case Assignment::Type::EqualStar:
+            E = makeBinary(BinaryOp::Mul, F, E);
+            break;
+        case Assignment::Type::EqualSlash:
+            E = makeBinary(BinaryOp::Div, F, E);
+            break;
+        case Assignment::Type::EqualMod:
+            E = makeBinary(BinaryOp::Mod, F, E);
+            break;
+        default:
+            break;
     }
-    return Left;
+    return new (Ctx) Assignment(F, E, T);
 }
 
-Expr *Parser::parseExpr3()
-{
-    Expr *Left = parseExpr4();
-    while (Tok.isOneOf(Token::greater_equal, Token::lower_equal))
-    {
-        BinaryOp::Operator Op =
-            Tok.is(Token::greater_equal) ? BinaryOp::GreaterEqual : BinaryOp::LowerEqual;
-        advance();
-        Expr *Right = parseExpr4();
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
+namespace {
+// Binary operator table indexed by Token::TokenKind. Prec is the binding power
+// (0 for tokens that are not binary operators); all operators are left-associative.
+struct BinOpInfo {
+    unsigned char Prec;
+    BinaryOp::Operator Op;
+};
+
+const BinOpInfo BinOps[] = {
+    {0, BinaryOp::Plus},         // eoi
+    {0, BinaryOp::Plus},         // unknown
+    {0, BinaryOp::Plus},         // ident
+    {0, BinaryOp::Plus},         // number
+    {0, BinaryOp::Plus},         // equal
+    {0, BinaryOp::Plus},         // comma
+    {0, BinaryOp::Plus},         // semicolon
+    {0, BinaryOp::Plus},         // colon
+    {6, BinaryOp::Plus},         // plus
+    {6, BinaryOp::Minus},        // minus
+    {7, BinaryOp::Mul},          // star
+    {7, BinaryOp::Div},          // slash
+    {7, BinaryOp::Mod},          // module
+    {8, BinaryOp::Power},        // power
+    {0, BinaryOp::Plus},         // l_paren
+    {0, BinaryOp::Plus},         // r_paren
+    {0, BinaryOp::Plus},         // KW_int
+    {0, BinaryOp::Plus},         // KW_print
+    {3, BinaryOp::DoubleEqual},  // double_equal
+    {3, BinaryOp::NotEqual},     // not_equal
+    {5, BinaryOp::Greater},      // greater
+    {4, BinaryOp::GreaterEqual}, // greater_equal
+    {5, BinaryOp::Lower},        // lower
+    {4, BinaryOp::LowerEqual},   // lower_equal
+    {0, BinaryOp::Plus},         // ifc
+    {0, BinaryOp::Plus},         // elif
+    {0, BinaryOp::Plus},         // elsec
+    {0, BinaryOp::Plus},         // begin
+    {0, BinaryOp::Plus},         // end
+    {0, BinaryOp::Plus},         // loopc
+    {2, BinaryOp::And},          // andc
+    {1, BinaryOp::Or},           // orc
+    {0, BinaryOp::Plus},         // equal_plus
+    {0, BinaryOp::Plus},         // equal_minus
+    {0, BinaryOp::Plus},         // equal_star
+    {0, BinaryOp::Plus},         // equal_slash
+    {0, BinaryOp::Plus},         // equal_mod
+    {0, BinaryOp::Plus},         // start_comment
+    {0, BinaryOp::Plus},         // end_comment
+};
+static_assert(sizeof(BinOps) / sizeof(BinOps[0]) == Token::NUM_TOKENS,
+              "BinOps must have one entry per token kind");
 }
 
-Expr *Parser::parseExpr4()
+Expr *Parser::parseExpr()
 {
-    Expr *Left = parseExpr5();
-    while (Tok.isOneOf(Token::greater, Token::lower))
-    {
-        BinaryOp::Operator Op =
-            Tok.is(Token::greater) ? BinaryOp::Greater : BinaryOp::Lower;
-        advance();
-        Expr *Right = parseExpr5();
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
+    return parseBinary(parseFactor(), 1);
 }
 
-Expr *Parser::parseExpr5()
+Factor *Parser::makeFactor(Factor::ValueKind Kind, llvm::StringRef Text)
 {
-    Expr *Left = parseExpr6();
-    while (Tok.isOneOf(Token::plus, Token::minus))
-    {
-        BinaryOp::Operator Op =
-            Tok.is(Token::plus) ? BinaryOp::Plus : BinaryOp::Minus;
-        advance();
-        Expr *Right = parseExpr6();
-        Left = new BinaryOp(Op, Left, Right);
+    uint32_t Sym = Kind == Factor::Ident ? Ctx.getSymbols().intern(Text) : 0;
+    if (!HashCons)
+        return new (Ctx) Factor(Kind, Text, Sym);
+    Factor *&Slot = Kind == Factor::Ident ? SharedIdents[Sym] : SharedNumbers[Text];
+    if (Slot) {
+        Slot->setShared();
+        ++NumShared;
+        return Slot;
     }
-    return Left;
+    return Slot = new (Ctx) Factor(Kind, Text, Sym);
 }
 
-Expr *Parser::parseExpr6()
+// operands are already unique, so an operator is identified by its operand pointers
+Expr *Parser::makeBinary(BinaryOp::Operator Op, Expr *Left, Expr *Right)
 {
-    Expr *Left = parseExpr7();
-    while (Tok.isOneOf(Token::star, Token::slash, Token::module))
-    {
-        BinaryOp::Operator Op =
-            Tok.is(Token::star) ? BinaryOp::Mul : (Tok.is(Token::slash) ? BinaryOp::Div : BinaryOp::Mod);
-        advance();
-        Expr *Right = parseExpr7();
-        Left = new BinaryOp(Op, Left, Right);
+    if (!HashCons)
+        return new (Ctx) BinaryOp(Op, Left, Right);
+    BinaryOp *&Slot = SharedOps[{{Left, Right}, unsigned(Op)}];
+    if (Slot) {
+        Slot->setShared();
+        ++NumShared;
+        return Slot;
     }
-    return Left;
+    return Slot = new (Ctx) BinaryOp(Op, Left, Right);
 }
 
-Expr *Parser::parseExpr7()
+// precedence climbing: fold every operator binding at least as tightly as
+// MinPrec into Left, parsing tighter operators on the right recursively
+Expr *Parser::parseBinary(Expr *Left, unsigned MinPrec)
 {
-    Expr *Left = parseFactor();
-    while (Tok.is(Token::power))
+    while (true)
     {
-        BinaryOp::Operator Op = BinaryOp::Power;
+        const BinOpInfo &Info = BinOps[Tok.getKind()];
+        if (Info.Prec == 0 || Info.Prec < MinPrec)
+            return Left;
         advance();
         Expr *Right = parseFactor();
-        Left = new BinaryOp(Op, Left, Right);
+        while (BinOps[Tok.getKind()].Prec > Info.Prec)
+            Right = parseBinary(Right, Info.Prec + 1);
+        Left = makeBinary(Info.Op, Left, Right);
     }
-    return Left;
 }
 
 Expr *Parser::parseFactor()
@@ -313,11 +411,17 @@ Expr *Parser::parseFactor()
     switch (Tok.getKind())
     {
     case Token::number:
-        Res = new Factor(Factor::Number, Tok.getText());
+    {
+        // Later passes read literals as int; reject those that do not fit.
+        int Value;
+        if (Tok.getText().getAsInteger(10, Value))
+            error("a 32-bit integer");
+        Res = makeFactor(Factor::Number, Tok.getText());
         advance();
         break;
+    }
     case Token::ident:
-        Res = new Factor(Factor::Ident, Tok.getText());
+        Res = makeFactor(Factor::Ident, Tok.getText());
         advance();
         break;
     case Token::l_paren:
@@ -342,7 +446,7 @@ Expr *Parser::parseIfElse()
     Assignment *A;
     Expr *E;
     llvm::SmallVector<Expr *> conditions;
-    llvm::SmallVector<llvm::SmallVector<Assignment *>> assignments;
+    llvm::SmallVector<llvm::ArrayRef<Assignment *>> assignments;
 
     if (expect(Token::ifc))
         error((const char *)"ifc");
@@ -375,7 +479,7 @@ Expr *Parser::parseIfElse()
                 error((const char *)"random");
         } else error((const char *)"ident");
     }
-    assignments.push_back(currentAssignments);
+    assignments.push_back(Ctx.copy<Assignment *>(currentAssignments));
     if (expect(Token::end))
         error((const char *)"end");
     advance();
@@ -412,7 +516,7 @@ Expr *Parser::parseIfElse()
                     error();
             } else error();
         }
-        assignments.push_back(currentAssignments);
+        assignments.push_back(Ctx.copy<Assignment *>(currentAssignments));
         advance();
     }
 
@@ -444,11 +548,11 @@ Expr *Parser::parseIfElse()
                     error();
             } else error();
         }
-        assignments.push_back(currentAssignments);
+        assignments.push_back(Ctx.copy<Assignment *>(currentAssignments));
         advance();
     }
     
-    return new IfElse(conditions, assignments);
+    return new (Ctx) IfElse(Ctx.copy<Expr *>(conditions), Ctx.copy<llvm::ArrayRef<Assignment *>>(assignments));
     _error: // TODO: Check this later in case of error :)
     while (Tok.getKind() != Token::eoi)
         advance();
@@ -460,6 +564,7 @@ Expr *Parser::parseLoop()
     Assignment *A;
     Expr *Condition;
     llvm::SmallVector<Assignment *> assignments;
+    LoopHints Hints;
 
     if (expect(Token::loopc)) {
         error();
@@ -470,6 +575,18 @@ Expr *Parser::parseLoop()
 
     Condition = parseExpr();
 
+    // "unroll" and "vectorize" are only keywords here, so they remain valid
+    // variable names.
+    while (Tok.is(Token::ident) && (Tok.getText() == "unroll" || Tok.getText() == "vectorize")) {
+        unsigned &Hint = Tok.getText() == "unroll" ? Hints.Unroll : Hints.Vectorize;
+        advance();
+        if (!Tok.is(Token::number) || Tok.getText().getAsInteger(10, Hint) || Hint == 0) {
+            error("a positive count");
+            goto _error;
+        }
+        advance();
+    }
+
     if (expect(Token::colon)) {
         error();
         goto _error;
@@ -511,25 +628,9 @@ Expr *Parser::parseLoop()
     }
     advance();
     
-    return new Loop(Condition, assignments);
+    return new (Ctx) Loop(Condition, Ctx.copy<Assignment *>(assignments), Hints);
     _error: // TODO: Check this later in case of error :)
     while (Tok.getKind() != Token::eoi)
         advance();
     return nullptr;
 }
-
-void Parser::parseComment()
-{
-    if (expect(Token::start_comment)) {
-        error();
-        goto _error;
-    }
-    advance();
-
-    while (!Tok.isOneOf(Token::end_comment, Token::eoi)) advance();
-
-    return;
-    _error: // TODO: Check this later in case of error :)
-    while (Tok.getKind() != Token::eoi)
-        advance();
-}
\ No newline at end of file
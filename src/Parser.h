@@ -3,28 +3,55 @@
 
 #include "AST.h"
 #include "Lexer.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/raw_ostream.h"
 
 class Parser
 {
-    Lexer &Lex;    // retrieve the next token from the input
+    Lexer *Lex;            // retrieve the next token from the input, or
+    const TokenStream *Stream; // read tokens lexed up front
+    size_t StreamPos;      // index of the token after Tok in Stream
+    const char *BufferStart; // start of the input, for offsets in diagnostics
+    ASTContext &Ctx; // owns the nodes of the AST being built
     Token Tok;     // stores the next token
     bool HasError; // indicates if an error was detected
+    unsigned TokensRead; // for --stats, added up once parsing is done
+
+    // Hash-consing: identical factors and operators over the same operands are
+    // created once, so repeated subexpressions form a DAG.
+    bool HashCons;
+    llvm::DenseMap<uint32_t, Factor *> SharedIdents;
+    llvm::StringMap<Factor *> SharedNumbers;
+    llvm::DenseMap<std::pair<std::pair<Expr *, Expr *>, unsigned>, BinaryOp *> SharedOps;
+    unsigned NumShared;
+
+    Factor *makeFactor(Factor::ValueKind Kind, llvm::StringRef Text);
+    Expr *makeBinary(BinaryOp::Operator Op, Expr *Left, Expr *Right);
+
+    size_t getOffset() { return Tok.getText().data() - BufferStart; }
 
     void error(){
-        llvm::errs() << "Unexpected: " << Tok.getText() << "\n";
+        llvm::errs() << "Unexpected: " << Tok.getText() << " at offset " << getOffset() << "\n";
         HasError = true;
     }
 
     void error(const char * inp){
-        llvm::errs() << "Unexpected: " << Tok.getText() << ", Expected: " << inp << "\n";
+        llvm::errs() << "Unexpected: " << Tok.getText() << " at offset " << getOffset()
+                     << ", Expected: " << inp << "\n";
         HasError = true;
     }
 
     // retrieves the next token from the lexer.expect()
     // tests whether the look-ahead is of the expected kind
-    // void advance() { llvm::errs() << "Consumed: " << Tok.getText() << "\n"; Lex.next(Tok); }
-    void advance() { Lex.next(Tok); }
+    void advance()
+    {
+        ++TokensRead;
+        if (Stream)
+            Stream->get(StreamPos++, Tok);
+        else
+            Lex->next(Tok);
+    }
 
     bool expect(Token::TokenKind Kind)
     {
@@ -50,26 +77,32 @@ class Parser
     Expr *parseDec();
     Assignment *parseAssign();
     Expr *parseExpr();
-    Expr *parseExpr1();
-    Expr *parseExpr2();
-    Expr *parseExpr3();
-    Expr *parseExpr4();
-    Expr *parseExpr5();
-    Expr *parseExpr6();
-    Expr *parseExpr7();
+    Expr *parseBinary(Expr *Left, unsigned MinPrec);
     Expr *parseFactor();
     Expr *parseIfElse();
     Expr *parseLoop();
     Expr *parsePrint();
-    void parseComment();
 
 public:
     // initializes all members and retrieves the first token
-    Parser(Lexer &Lex) : Lex(Lex), HasError(false)
+    Parser(Lexer &Lex, ASTContext &Ctx)
+        : Lex(&Lex), Stream(nullptr), StreamPos(0), BufferStart(Lex.getBufferStart()),
+          Ctx(Ctx), HasError(false), TokensRead(0), HashCons(false), NumShared(0)
     {
         advance();
     }
 
+    // parse a pre-lexed token stream instead of pulling tokens from a lexer
+    Parser(const TokenStream &Stream, ASTContext &Ctx)
+        : Lex(nullptr), Stream(&Stream), StreamPos(0), BufferStart(Stream.getBuffer().data()),
+          Ctx(Ctx), HasError(false), TokensRead(0), HashCons(false), NumShared(0)
+    {
+        advance();
+    }
+
+    // share identical subexpressions instead of building a fresh tree for each
+    void setHashConsing(bool Enable) { HashCons = Enable; }
+
     // get the value of error flag
     bool hasError() { return HasError; }
 
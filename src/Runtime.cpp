@@ -0,0 +1,16 @@
+#include "Runtime.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Support/MemoryBufferRef.h"
+
+using namespace llvm;
+
+// The bitcode reader expects a 4-byte aligned buffer.
+alignas(4) static const unsigned char RuntimeBitcode[] = {
+#include "RuntimeBitcode.inc"
+};
+
+Expected<std::unique_ptr<Module>> loadRuntime(LLVMContext &Ctx)
+{
+  StringRef Bytes(reinterpret_cast<const char *>(RuntimeBitcode), sizeof(RuntimeBitcode));
+  return parseBitcodeFile(MemoryBufferRef(Bytes, "rtGSM.bc"), Ctx);
+}
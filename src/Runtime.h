@@ -0,0 +1,11 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+
+// Parse the runtime module (rtGSM.ll, embedded as bitcode at build time) into Ctx.
+llvm::Expected<std::unique_ptr<llvm::Module>> loadRuntime(llvm::LLVMContext &Ctx);
+
+#endif
@@ -0,0 +1,108 @@
+#include "SSABuilder.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+
+using namespace llvm;
+
+Value *SSABuilder::read(uint32_t Sym, BasicBlock *BB)
+{
+  // Local value numbering: the last write in the block wins.
+  auto It = CurrentDef[Sym].find(BB);
+  if (It != CurrentDef[Sym].end())
+    return It->second;
+  return readRecursive(Sym, BB);
+}
+
+PHINode *SSABuilder::createPhi(uint32_t Sym, BasicBlock *BB)
+{
+  // Phis go in front of everything else already emitted into the block.
+  if (BB->empty())
+    return PHINode::Create(Ty, 2, Symbols.getName(Sym), BB);
+  return PHINode::Create(Ty, 2, Symbols.getName(Sym), &BB->front());
+}
+
+Value *SSABuilder::readRecursive(uint32_t Sym, BasicBlock *BB)
+{
+  Value *V;
+  if (Unsealed.count(BB))
+  {
+    // Not all predecessors are known yet, so the operands are added by seal().
+    PHINode *Phi = createPhi(Sym, BB);
+    IncompletePhis[BB].push_back({Sym, Phi});
+    V = Phi;
+  }
+  else if (BasicBlock *Pred = BB->getSinglePredecessor())
+  {
+    // No phi needed with a single predecessor.
+    V = read(Sym, Pred);
+  }
+  else if (pred_empty(BB))
+  {
+    // Only reachable for reads in unreachable code; sema rejects reading
+    // variables before their declaration.
+    V = UndefValue::get(Ty);
+  }
+  else
+  {
+    // Record the phi first so that reads through a cycle terminate.
+    PHINode *Phi = createPhi(Sym, BB);
+    write(Sym, BB, Phi);
+    V = addPhiOperands(Sym, Phi);
+  }
+  write(Sym, BB, V);
+  return V;
+}
+
+Value *SSABuilder::addPhiOperands(uint32_t Sym, PHINode *Phi)
+{
+  for (BasicBlock *Pred : predecessors(Phi->getParent()))
+    Phi->addIncoming(read(Sym, Pred), Pred);
+  return tryRemoveTrivialPhi(Phi);
+}
+
+Value *SSABuilder::tryRemoveTrivialPhi(PHINode *Phi)
+{
+  Value *Same = nullptr;
+  for (Value *Op : Phi->incoming_values())
+  {
+    // Unique value or self-reference.
+    if (Op == Same || Op == Phi)
+      continue;
+    // The phi merges at least two values, so it is not trivial.
+    if (Same)
+      return Phi;
+    Same = Op;
+  }
+  if (!Same)
+    Same = UndefValue::get(Ty); // the phi is unreachable or in the entry block
+
+  // Replacing the phi may make phis using it trivial as well. The current
+  // definitions are tracking handles, so they follow the replacement, and so
+  // does the result in case Same is one of those phis.
+  WeakTrackingVH Result(Same);
+  SmallVector<WeakVH, 8> Users;
+  for (User *U : Phi->users())
+    if (U != Phi && isa<PHINode>(U))
+      Users.push_back(U);
+  Phi->replaceAllUsesWith(Same);
+  Phi->eraseFromParent();
+
+  for (WeakVH &U : Users)
+    if (auto *UserPhi = dyn_cast_or_null<PHINode>(U))
+      tryRemoveTrivialPhi(UserPhi);
+  return Result;
+}
+
+void SSABuilder::seal(BasicBlock *BB)
+{
+  Unsealed.erase(BB);
+  auto It = IncompletePhis.find(BB);
+  if (It == IncompletePhis.end())
+    return;
+
+  // addPhiOperands may add phis to other blocks, so take the list first.
+  SmallVector<std::pair<uint32_t, PHINode *>, 4> Phis = std::move(It->second);
+  IncompletePhis.erase(It);
+  for (auto &Incomplete : Phis)
+    addPhiOperands(Incomplete.first, Incomplete.second);
+}
@@ -0,0 +1,47 @@
+#ifndef SSABUILDER_H
+#define SSABUILDER_H
+
+#include "SymbolTable.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ValueHandle.h"
+#include <vector>
+
+// SSABuilder turns variable reads and writes into SSA values while the IR is
+// being built, following Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form" (CC 2013). It remembers the current definition
+// of every variable in every block; a read in a block without one looks through
+// the predecessors and inserts a phi where they may disagree. Blocks that can
+// still get predecessors (loop headers before their back edge) are unsealed:
+// reads there create operand-less phis that are completed by seal(). Phis whose
+// operands all turn out to be one value are removed again.
+class SSABuilder
+{
+  llvm::Type *Ty;                 // type of every variable
+  const SymbolTable &Symbols;     // names for the phis
+  std::vector<llvm::DenseMap<llvm::BasicBlock *, llvm::WeakTrackingVH>> CurrentDef; // per symbol id
+  llvm::DenseMap<llvm::BasicBlock *, llvm::SmallVector<std::pair<uint32_t, llvm::PHINode *>, 4>>
+      IncompletePhis;
+  llvm::SmallPtrSet<llvm::BasicBlock *, 8> Unsealed;
+
+  llvm::PHINode *createPhi(uint32_t Sym, llvm::BasicBlock *BB);
+  llvm::Value *readRecursive(uint32_t Sym, llvm::BasicBlock *BB);
+  llvm::Value *addPhiOperands(uint32_t Sym, llvm::PHINode *Phi);
+  llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *Phi);
+
+public:
+  SSABuilder(llvm::Type *Ty, const SymbolTable &Symbols)
+      : Ty(Ty), Symbols(Symbols), CurrentDef(Symbols.size()) {}
+
+  void write(uint32_t Sym, llvm::BasicBlock *BB, llvm::Value *V) { CurrentDef[Sym][BB] = V; }
+  llvm::Value *read(uint32_t Sym, llvm::BasicBlock *BB);
+
+  // BB will get more predecessors; call seal() once the last one branches to it.
+  void markUnsealed(llvm::BasicBlock *BB) { Unsealed.insert(BB); }
+  void seal(llvm::BasicBlock *BB);
+};
+
+#endif
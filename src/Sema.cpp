@@ -1,10 +1,18 @@
 #include "Sema.h"
-#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Support/raw_ostream.h"
 
+#define DEBUG_TYPE "sema"
+
+ALWAYS_ENABLED_STATISTIC(NumSymbols, "Number of distinct identifiers");
+ALWAYS_ENABLED_STATISTIC(NumDeclared, "Number of variables declared");
+ALWAYS_ENABLED_STATISTIC(NumErrors, "Number of semantic errors reported");
+
 namespace {
-class InputCheck : public ASTVisitor {
-  llvm::StringSet<> Scope; // StringSet to store declared variables
+class InputCheck : public ASTVisitor<InputCheck> {
+  const SymbolTable &Symbols; // spelling of the symbol ids, for diagnostics
+  llvm::BitVector Declared; // declared variables, indexed by symbol id
   bool HasError; // Flag to indicate if an error occurred
 
   enum ErrorType { Twice, Not, TooMany }; // Enum to represent error types: Twice - variable declared twice, Not - variable not declared
@@ -19,15 +27,59 @@ class InputCheck : public ASTVisitor {
       llvm::errs() << "Too many values for declaration\n";
     }
     HasError = true; // Set error flag to true
+    ++NumErrors;
   }
 
 public:
-  InputCheck() : HasError(false) {} // Constructor
+  InputCheck(const SymbolTable &Symbols)
+      : Symbols(Symbols), Declared(Symbols.size()), HasError(false) {} // Constructor
 
   bool hasError() { return HasError; } // Function to check if an error occurred
 
+  // Add the totals of this check to the statistics.
+  void countStats() {
+    NumSymbols += Symbols.size();
+    NumDeclared += Declared.count();
+  }
+
+  // Check a flattened tree. Its nodes are stored in source order, so a single
+  // linear scan sees every declaration before the uses that follow it.
+  void check(const FlatAST &F) {
+    for (FlatAST::NodeId N = 0, E = F.size(); N != E; ++N) {
+      switch (F.getKind(N)) {
+      case FlatAST::Ident:
+      case FlatAST::Assign:
+        if (!Declared.test(F.getSymbol(N)))
+          error(Not, Symbols.getName(F.getSymbol(N)));
+        break;
+      case FlatAST::Binary:
+        if (F.getOperator(N) == BinaryOp::Div &&
+            F.getKind(F.getRight(N)) == FlatAST::Number &&
+            F.getValue(F.getRight(N)) == 0) {
+          llvm::errs() << "Division by zero is not allowed." << "\n";
+          HasError = true;
+          ++NumErrors;
+        }
+        break;
+      case FlatAST::Decl: {
+        llvm::ArrayRef<uint32_t> Vars = F.getDeclVars(N);
+        for (uint32_t Var : Vars) {
+          if (Declared.test(Var))
+            error(Twice, Symbols.getName(Var));
+          Declared.set(Var);
+        }
+        if (F.getDeclExprs(N).size() > Vars.size())
+          error(TooMany, Symbols.getName(Vars.front()));
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
   // Visit function for GSM nodes
-  virtual void visit(GSM &Node) override { 
+  void visit(GSM &Node) { 
     for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
     {
       (*I)->accept(*this); // Visit each child node
@@ -35,16 +87,16 @@ public:
   };
 
   // Visit function for Factor nodes
-  virtual void visit(Factor &Node) override {
-    if (Node.getKind() == Factor::Ident) {
+  void visit(Factor &Node) {
+    if (Node.getValueKind() == Factor::Ident) {
       // Check if identifier is in the scope
-      if (Scope.find(Node.getVal()) == Scope.end())
+      if (!Declared.test(Node.getSymbol()))
         error(Not, Node.getVal());
     }
   };
 
   // Visit function for BinaryOp nodes
-  virtual void visit(BinaryOp &Node) override {
+  void visit(BinaryOp &Node) {
     if (Node.getLeft())
       Node.getLeft()->accept(*this);
     else
@@ -57,73 +109,103 @@ public:
       HasError = true;
 
     if (Node.getOperator() == BinaryOp::Operator::Div && right) {
-      Factor * f = (Factor *)right;
+      Factor * f = llvm::dyn_cast<Factor>(right);
 
-      if (right && f->getKind() == Factor::ValueKind::Number) {
+      if (f && f->getValueKind() == Factor::ValueKind::Number) {
         int intval;
         f->getVal().getAsInteger(10, intval);
 
         if (intval == 0) {
           llvm::errs() << "Division by zero is not allowed." << "\n";
           HasError = true;
+          ++NumErrors;
         }
       }
     }
   };
 
-  // Visit function for Assignment nodes
-  virtual void visit(Assignment &Node) override {
+  // Visit function for Assignment nodes. The value is checked before the
+  // destination, in the order the flattened tree stores them.
+  void visit(Assignment &Node) {
     Factor *dest = Node.getLeft();
 
-    dest->accept(*this);
+    if (Node.getRight())
+      Node.getRight()->accept(*this);
 
-    if (dest->getKind() == Factor::Number) {
+    if (dest->getValueKind() == Factor::Number) {
         llvm::errs() << "Assignment destination must be an identifier.";
         HasError = true;
     }
 
-    if (dest->getKind() == Factor::Ident) {
+    if (dest->getValueKind() == Factor::Ident) {
       // Check if the identifier is in the scope
-      if (Scope.find(dest->getVal()) == Scope.end())
+      if (!Declared.test(dest->getSymbol()))
         error(Not, dest->getVal());
     }
-
-    if (Node.getRight())
-      Node.getRight()->accept(*this);
   };
 
-  virtual void visit(Print &Node) override {
+  void visit(Print &Node) {
     Expr *e = Node.getExpr();
 
     e->accept(*this);
   };
 
-  virtual void visit(Declaration &Node) override {
+  // The initializers are checked first, as the variables are declared only
+  // after them.
+  void visit(Declaration &Node) {
+    for (Expr *E : Node.getExprs())
+      E->accept(*this);
+
     int number_of_variables = 0;
     for (auto I = Node.begin_vars(), E = Node.end_vars(); I != E;
          ++I) {
       number_of_variables++;
-      if (!Scope.insert(*I).second)
-        error(Twice, *I); // If the insertion fails (element already exists in Scope), report a "Twice" error
+      if (Declared.test(*I))
+        error(Twice, Symbols.getName(*I)); // If the variable is already declared, report a "Twice" error
+      Declared.set(*I);
     }
     int number_of_exprs = 0;
     for (auto I = Node.begin_exprs(), E = Node.end_exprs(); I != E;
          ++I) {
       number_of_exprs++;
     }
-    if (number_of_exprs > number_of_variables) error(TooMany, *Node.begin_vars());
-    // if (Node.getExpr()) TODO: What the fuck?
-    //   Node.getExpr()->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
+    if (number_of_exprs > number_of_variables) error(TooMany, Symbols.getName(*Node.begin_vars()));
+  };
+
+  // Each condition is checked before the body it guards.
+  void visit(IfElse &Node) {
+    llvm::ArrayRef<Expr *> Conditions = Node.getConditions();
+    llvm::ArrayRef<llvm::ArrayRef<Assignment *>> Bodies = Node.getAssignments();
+    for (size_t I = 0, E = Bodies.size(); I != E; ++I) {
+      if (I < Conditions.size())
+        Conditions[I]->accept(*this);
+      for (Assignment *A : Bodies[I])
+        A->accept(*this);
+    }
+  };
+
+  void visit(Loop &Node) {
+    Node.getCondition()->accept(*this);
+    for (Assignment *A : Node.getAssignments())
+      A->accept(*this);
   };
 };
 }
 
-bool Sema::semantic(AST *Tree) {
+bool Sema::semantic(AST *Tree, const SymbolTable &Symbols) {
   if (!Tree)
     return false; // If the input AST is not valid, return false indicating no errors
 
-  InputCheck Check; // Create an instance of the InputCheck class for semantic analysis
+  InputCheck Check(Symbols); // Create an instance of the InputCheck class for semantic analysis
   Tree->accept(Check); // Initiate the semantic analysis by traversing the AST using the accept function
+  Check.countStats();
 
   return Check.hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
 }
+
+bool Sema::semantic(const FlatAST &Tree) {
+  InputCheck Check(Tree.getSymbols());
+  Check.check(Tree);
+  Check.countStats();
+  return Check.hasError();
+}
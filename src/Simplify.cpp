@@ -0,0 +1,635 @@
+#include "Simplify.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include <cstdint>
+#include <string>
+
+#define DEBUG_TYPE "simplify"
+
+ALWAYS_ENABLED_STATISTIC(NumFolded, "Number of operators folded to a constant");
+ALWAYS_ENABLED_STATISTIC(NumIdentities, "Number of operators removed by algebraic identities");
+ALWAYS_ENABLED_STATISTIC(NumDeadArms, "Number of if arms removed");
+ALWAYS_ENABLED_STATISTIC(NumDeadLoops, "Number of loops removed");
+
+namespace {
+// What a binary operator reduces to, given which of its operands are constant.
+// Both tree forms apply the same rules. Dropping an operand is always allowed
+// because GSM expressions have no side effects.
+struct Reduction
+{
+  enum KindTy : uint8_t
+  {
+    None,     // keep the operator
+    Constant, // the constant Value
+    Left,     // the left operand
+    Right,    // the right operand
+    LeftBool, // the left operand compared against zero
+    RightBool // the right operand compared against zero
+  };
+  KindTy Kind = None;
+  int32_t Value = 0;
+};
+
+// Comparisons and and/or produce 0 or 1.
+bool isBoolean(BinaryOp::Operator Op)
+{
+  return Op != BinaryOp::Plus && Op != BinaryOp::Minus && Op != BinaryOp::Mul &&
+         Op != BinaryOp::Div && Op != BinaryOp::Mod && Op != BinaryOp::Power;
+}
+
+} // namespace
+
+bool evaluate(BinaryOp::Operator Op, int32_t L, int32_t R, int32_t &Result)
+{
+  uint32_t UL = L, UR = R;
+  switch (Op)
+  {
+  case BinaryOp::Plus:
+    Result = int32_t(UL + UR);
+    return true;
+  case BinaryOp::Minus:
+    Result = int32_t(UL - UR);
+    return true;
+  case BinaryOp::Mul:
+    Result = int32_t(UL * UR);
+    return true;
+  case BinaryOp::Div:
+  case BinaryOp::Mod:
+    if (R == 0 || (L == INT32_MIN && R == -1))
+      return false;
+    Result = Op == BinaryOp::Div ? L / R : L % R;
+    return true;
+  case BinaryOp::Power: {
+    uint32_t Pow = 1;
+    for (uint32_t Exp = R > 0 ? UR : 0; Exp; Exp >>= 1, UL *= UL)
+      if (Exp & 1)
+        Pow *= UL;
+    Result = int32_t(Pow);
+    return true;
+  }
+  case BinaryOp::Or:
+    Result = L || R;
+    return true;
+  case BinaryOp::And:
+    Result = L && R;
+    return true;
+  case BinaryOp::DoubleEqual:
+    Result = L == R;
+    return true;
+  case BinaryOp::NotEqual:
+    Result = L != R;
+    return true;
+  case BinaryOp::GreaterEqual:
+    Result = L >= R;
+    return true;
+  case BinaryOp::LowerEqual:
+    Result = L <= R;
+    return true;
+  case BinaryOp::Greater:
+    Result = L > R;
+    return true;
+  case BinaryOp::Lower:
+    Result = L < R;
+    return true;
+  }
+  return false;
+}
+
+namespace {
+
+// SameVar is set when both operands read the same variable.
+Reduction reduce(BinaryOp::Operator Op, llvm::Optional<int32_t> L, llvm::Optional<int32_t> R, bool SameVar)
+{
+  auto Const = [](int32_t Value) { return Reduction{Reduction::Constant, Value}; };
+  auto Keep = [](Reduction::KindTy Kind) { return Reduction{Kind, 0}; };
+  if (L && R)
+  {
+    int32_t Value;
+    return evaluate(Op, *L, *R, Value) ? Const(Value) : Reduction();
+  }
+  switch (Op)
+  {
+  case BinaryOp::Plus:
+    if (R == 0)
+      return Keep(Reduction::Left);
+    if (L == 0)
+      return Keep(Reduction::Right);
+    break;
+  case BinaryOp::Minus:
+    if (R == 0)
+      return Keep(Reduction::Left);
+    if (SameVar)
+      return Const(0);
+    break;
+  case BinaryOp::Mul:
+    if (R == 0 || L == 0)
+      return Const(0);
+    if (R == 1)
+      return Keep(Reduction::Left);
+    if (L == 1)
+      return Keep(Reduction::Right);
+    break;
+  case BinaryOp::Div:
+    if (R == 1)
+      return Keep(Reduction::Left);
+    break;
+  case BinaryOp::Mod:
+    if (R == 1 || R == -1)
+      return Const(0);
+    break;
+  case BinaryOp::Power:
+    if (R && *R <= 0)
+      return Const(1);
+    if (R == 1)
+      return Keep(Reduction::Left);
+    if (L == 1)
+      return Const(1);
+    break;
+  case BinaryOp::And:
+    if (L)
+      return *L ? Keep(Reduction::RightBool) : Const(0);
+    if (R)
+      return *R ? Keep(Reduction::LeftBool) : Const(0);
+    break;
+  case BinaryOp::Or:
+    if (L)
+      return *L ? Const(1) : Keep(Reduction::RightBool);
+    if (R)
+      return *R ? Const(1) : Keep(Reduction::LeftBool);
+    break;
+  case BinaryOp::DoubleEqual:
+  case BinaryOp::GreaterEqual:
+  case BinaryOp::LowerEqual:
+    if (SameVar)
+      return Const(1);
+    break;
+  case BinaryOp::NotEqual:
+  case BinaryOp::Greater:
+  case BinaryOp::Lower:
+    if (SameVar)
+      return Const(0);
+    break;
+  }
+  return Reduction();
+}
+
+void count(Reduction Red)
+{
+  if (Red.Kind == Reduction::Constant)
+    ++NumFolded;
+  else if (Red.Kind != Reduction::None)
+    ++NumIdentities;
+}
+
+// ASTSimplifier rebuilds the pointer AST bottom-up. Result holds the simplified
+// form of the node visited last, or null for a statement that was removed.
+class ASTSimplifier : public ASTVisitor<ASTSimplifier>
+{
+  ASTContext &Ctx;
+  Expr *Result = nullptr;
+  llvm::SmallVector<Expr *, 64> Stmts; // top-level statements of the new tree
+  llvm::DenseMap<Expr *, Expr *> SharedResults; // hash-consed nodes are simplified once
+
+  static llvm::Optional<int32_t> getConstant(Expr *E)
+  {
+    auto *F = llvm::dyn_cast<Factor>(E);
+    int Value;
+    if (!F || F->getValueKind() != Factor::Number || F->getVal().getAsInteger(10, Value))
+      return llvm::None;
+    return Value;
+  }
+
+  static bool isSameVar(Expr *L, Expr *R)
+  {
+    auto *FL = llvm::dyn_cast<Factor>(L);
+    auto *FR = llvm::dyn_cast<Factor>(R);
+    return FL && FR && FL->getValueKind() == Factor::Ident && FR->getValueKind() == Factor::Ident &&
+           FL->getSymbol() == FR->getSymbol();
+  }
+
+  Expr *makeNumber(int32_t Value)
+  {
+    return new (Ctx) Factor(Factor::Number, Ctx.copy(llvm::StringRef(std::to_string(Value))));
+  }
+
+  Expr *makeBool(Expr *E)
+  {
+    auto *B = llvm::dyn_cast<BinaryOp>(E);
+    if (B && isBoolean(B->getOperator()))
+      return E;
+    return new (Ctx) BinaryOp(BinaryOp::NotEqual, E, makeNumber(0));
+  }
+
+  Expr *simplify(Expr *E)
+  {
+    E->accept(*this);
+    return Result;
+  }
+
+  llvm::ArrayRef<Assignment *> simplifyBody(llvm::ArrayRef<Assignment *> Body)
+  {
+    llvm::SmallVector<Assignment *, 8> New;
+    bool Changed = false;
+    for (Assignment *A : Body)
+    {
+      New.push_back(llvm::cast<Assignment>(simplify(A)));
+      Changed |= New.back() != A;
+    }
+    return Changed ? Ctx.copy<Assignment *>(New) : Body;
+  }
+
+public:
+  ASTSimplifier(ASTContext &Ctx) : Ctx(Ctx) {}
+
+  AST *getResult() { return Result; }
+
+  void visit(GSM &Node)
+  {
+    for (Expr *E : Node)
+    {
+      // IfElse adds its own statements, an else arm may be all that is left.
+      E->accept(*this);
+      if (Result)
+        Stmts.push_back(Result);
+    }
+    Result = new (Ctx) GSM(Ctx.copy<Expr *>(Stmts));
+  };
+
+  void visit(Factor &Node)
+  {
+    Result = &Node;
+  };
+
+  void visit(BinaryOp &Node)
+  {
+    if (Node.isShared())
+    {
+      auto It = SharedResults.find(&Node);
+      if (It != SharedResults.end())
+      {
+        Result = It->second;
+        return;
+      }
+    }
+    Expr *L = simplify(Node.getLeft());
+    Expr *R = simplify(Node.getRight());
+    Reduction Red = reduce(Node.getOperator(), getConstant(L), getConstant(R), isSameVar(L, R));
+    count(Red);
+    switch (Red.Kind)
+    {
+    case Reduction::None:
+      Result = L == Node.getLeft() && R == Node.getRight() ? &Node : new (Ctx) BinaryOp(Node.getOperator(), L, R);
+      break;
+    case Reduction::Constant:
+      Result = makeNumber(Red.Value);
+      break;
+    case Reduction::Left:
+      Result = L;
+      break;
+    case Reduction::Right:
+      Result = R;
+      break;
+    case Reduction::LeftBool:
+      Result = makeBool(L);
+      break;
+    case Reduction::RightBool:
+      Result = makeBool(R);
+      break;
+    }
+    if (Node.isShared())
+    {
+      Result->setShared();
+      SharedResults[&Node] = Result;
+    }
+  };
+
+  void visit(Assignment &Node)
+  {
+    Expr *R = simplify(Node.getRight());
+    Result = R == Node.getRight() ? &Node : new (Ctx) Assignment(Node.getLeft(), R, Node.getType());
+  };
+
+  void visit(Print &Node)
+  {
+    Expr *E = simplify(Node.getExpr());
+    Result = E == Node.getExpr() ? &Node : new (Ctx) Print(E);
+  };
+
+  void visit(Declaration &Node)
+  {
+    llvm::SmallVector<Expr *, 8> Exprs;
+    bool Changed = false;
+    for (Expr *E : Node.getExprs())
+    {
+      Exprs.push_back(simplify(E));
+      Changed |= Exprs.back() != E;
+    }
+    Result = Changed ? new (Ctx) Declaration(llvm::ArrayRef<uint32_t>(Node.begin_vars(), Node.end_vars()),
+                                             Ctx.copy<Expr *>(Exprs))
+                     : &Node;
+  };
+
+  void visit(IfElse &Node)
+  {
+    llvm::ArrayRef<Expr *> Conditions = Node.getConditions();
+    llvm::ArrayRef<llvm::ArrayRef<Assignment *>> Bodies = Node.getAssignments();
+    llvm::SmallVector<Expr *, 8> NewConditions;
+    llvm::SmallVector<llvm::ArrayRef<Assignment *>, 8> NewBodies;
+    bool Changed = false;
+    for (size_t I = 0, E = Bodies.size(); I != E; ++I)
+    {
+      if (I == Conditions.size())
+      {
+        NewBodies.push_back(simplifyBody(Bodies[I]));
+        Changed |= NewBodies.back().data() != Bodies[I].data();
+        break;
+      }
+      Expr *Cond = simplify(Conditions[I]);
+      llvm::Optional<int32_t> Known = getConstant(Cond);
+      if (Known && !*Known)
+      {
+        ++NumDeadArms;
+        Changed = true;
+        continue;
+      }
+      if (Known)
+      {
+        // Always taken: the arm becomes the else and the arms after it are dead.
+        NumDeadArms += E - I - 1;
+        NewBodies.push_back(simplifyBody(Bodies[I]));
+        Changed = true;
+        break;
+      }
+      NewConditions.push_back(Cond);
+      NewBodies.push_back(simplifyBody(Bodies[I]));
+      Changed |= Cond != Conditions[I] || NewBodies.back().data() != Bodies[I].data();
+    }
+
+    Result = nullptr;
+    if (NewConditions.empty())
+    {
+      // At most an unconditional arm is left; its statements replace the if.
+      if (!NewBodies.empty())
+        Stmts.append(NewBodies.front().begin(), NewBodies.front().end());
+      return;
+    }
+    Stmts.push_back(Changed ? new (Ctx) IfElse(Ctx.copy<Expr *>(NewConditions),
+                                               Ctx.copy<llvm::ArrayRef<Assignment *>>(NewBodies))
+                            : &Node);
+  };
+
+  void visit(Loop &Node)
+  {
+    Expr *Cond = simplify(Node.getCondition());
+    llvm::Optional<int32_t> Known = getConstant(Cond);
+    if (Known && !*Known)
+    {
+      ++NumDeadLoops;
+      Result = nullptr;
+      return;
+    }
+    llvm::ArrayRef<Assignment *> Body = simplifyBody(Node.getAssignments());
+    Result = Cond == Node.getCondition() && Body.data() == Node.getAssignments().data()
+                 ? &Node
+                 : new (Ctx) Loop(Cond, Body, Node.getHints());
+  };
+};
+} // namespace
+
+// FlatSimplifier rebuilds a flat tree in two passes. The first records, in node
+// order, what each operator reduces to; the second emits only the nodes that
+// are still needed, so no folded operands are left behind in the arrays.
+class FlatSimplifier
+{
+  const FlatAST &Old;
+  FlatAST F;
+  llvm::SmallVector<Reduction, 0> Reduced; // per node of Old
+
+  FlatAST::NodeId add(FlatAST::NodeKind Kind, uint32_t L, uint32_t R = 0, uint8_t Op = 0)
+  {
+    F.Kinds.push_back(Kind);
+    F.Ops.push_back(Op);
+    F.LHS.push_back(L);
+    F.RHS.push_back(R);
+    return F.Kinds.size() - 1;
+  }
+
+  uint32_t addList(llvm::ArrayRef<uint32_t> Elts)
+  {
+    uint32_t Offset = F.Extra.size();
+    F.Extra.push_back(Elts.size());
+    F.Extra.append(Elts.begin(), Elts.end());
+    return Offset;
+  }
+
+  // The node of Old that N stands for once operators reduced to one of their
+  // operands are skipped.
+  FlatAST::NodeId resolve(FlatAST::NodeId N) const
+  {
+    while (Old.getKind(N) == FlatAST::Binary)
+    {
+      if (Reduced[N].Kind == Reduction::Left)
+        N = Old.getLeft(N);
+      else if (Reduced[N].Kind == Reduction::Right)
+        N = Old.getRight(N);
+      else
+        break;
+    }
+    return N;
+  }
+
+  llvm::Optional<int32_t> getConstant(FlatAST::NodeId N) const
+  {
+    N = resolve(N);
+    if (Old.getKind(N) == FlatAST::Number)
+      return Old.getValue(N);
+    if (Old.getKind(N) == FlatAST::Binary && Reduced[N].Kind == Reduction::Constant)
+      return Reduced[N].Value;
+    return llvm::None;
+  }
+
+  bool isSameVar(FlatAST::NodeId L, FlatAST::NodeId R) const
+  {
+    L = resolve(L);
+    R = resolve(R);
+    return Old.getKind(L) == FlatAST::Ident && Old.getKind(R) == FlatAST::Ident &&
+           Old.getSymbol(L) == Old.getSymbol(R);
+  }
+
+  bool isBooleanNode(FlatAST::NodeId N) const
+  {
+    N = resolve(N);
+    if (Old.getKind(N) != FlatAST::Binary)
+      return false;
+    Reduction::KindTy Kind = Reduced[N].Kind;
+    return Kind == Reduction::LeftBool || Kind == Reduction::RightBool ||
+           (Kind == Reduction::None && isBoolean(Old.getOperator(N)));
+  }
+
+  void analyze()
+  {
+    Reduced.resize(Old.size());
+    for (FlatAST::NodeId N = 0, E = Old.size(); N != E; ++N)
+    {
+      if (Old.getKind(N) != FlatAST::Binary)
+        continue;
+      FlatAST::NodeId L = Old.getLeft(N), R = Old.getRight(N);
+      Reduced[N] = reduce(Old.getOperator(N), getConstant(L), getConstant(R), isSameVar(L, R));
+      count(Reduced[N]);
+    }
+  }
+
+  FlatAST::NodeId emit(FlatAST::NodeId N)
+  {
+    N = resolve(N);
+    switch (Old.getKind(N))
+    {
+    case FlatAST::Number:
+      return add(FlatAST::Number, uint32_t(Old.getValue(N)));
+    case FlatAST::Ident:
+      return add(FlatAST::Ident, Old.getSymbol(N));
+    default:
+      break;
+    }
+
+    BinaryOp::Operator Op = Old.getOperator(N);
+    switch (Reduced[N].Kind)
+    {
+    case Reduction::Constant:
+      return add(FlatAST::Number, uint32_t(Reduced[N].Value));
+    case Reduction::LeftBool:
+    case Reduction::RightBool: {
+      FlatAST::NodeId Operand = Reduced[N].Kind == Reduction::LeftBool ? Old.getLeft(N) : Old.getRight(N);
+      if (isBooleanNode(Operand))
+        return emit(Operand);
+      FlatAST::NodeId L = emit(Operand);
+      return add(FlatAST::Binary, L, add(FlatAST::Number, 0), BinaryOp::NotEqual);
+    }
+    default: {
+      FlatAST::NodeId L = emit(Old.getLeft(N));
+      if (Op == BinaryOp::And || Op == BinaryOp::Or)
+        add(FlatAST::Logical, L, 0, Op);
+      FlatAST::NodeId R = emit(Old.getRight(N));
+      return add(FlatAST::Binary, L, R, Op);
+    }
+    }
+  }
+
+  uint32_t emitBody(llvm::ArrayRef<FlatAST::NodeId> Body)
+  {
+    llvm::SmallVector<uint32_t, 8> Ids;
+    for (FlatAST::NodeId S : Body)
+      emitStmt(S, Ids);
+    return addList(Ids);
+  }
+
+  // Append the simplified statement N, if any, to Out.
+  void emitStmt(FlatAST::NodeId N, llvm::SmallVectorImpl<uint32_t> &Out)
+  {
+    switch (Old.getKind(N))
+    {
+    case FlatAST::Assign: {
+      FlatAST::NodeId Value = emit(Old.getAssignedValue(N));
+      Out.push_back(add(FlatAST::Assign, Old.getSymbol(N), Value));
+      break;
+    }
+    case FlatAST::Print:
+      Out.push_back(add(FlatAST::Print, emit(Old.getPrinted(N))));
+      break;
+    case FlatAST::Decl: {
+      llvm::SmallVector<uint32_t, 8> Exprs;
+      for (FlatAST::NodeId E : Old.getDeclExprs(N))
+        Exprs.push_back(emit(E));
+      uint32_t VarList = addList(Old.getDeclVars(N));
+      Out.push_back(add(FlatAST::Decl, VarList, addList(Exprs)));
+      break;
+    }
+    case FlatAST::IfElse: {
+      // Pick the arms that can still be taken before emitting anything.
+      llvm::SmallVector<unsigned, 8> Live;
+      bool Unconditional = false;
+      for (unsigned Arm = 0, E = Old.getNumArms(N); Arm != E; ++Arm)
+      {
+        FlatAST::NodeId Cond = Old.getArmCondition(N, Arm);
+        llvm::Optional<int32_t> Known;
+        if (Cond != FlatAST::None)
+          Known = getConstant(Cond);
+        if (Known && !*Known)
+        {
+          ++NumDeadArms;
+          continue;
+        }
+        Live.push_back(Arm);
+        if (Cond == FlatAST::None || Known)
+        {
+          NumDeadArms += E - Arm - 1;
+          Unconditional = true;
+          break;
+        }
+      }
+      if (Live.size() == 1 && Unconditional)
+      {
+        // Only an unconditional arm is left; its statements replace the if.
+        for (FlatAST::NodeId S : Old.getArmBody(N, Live.front()))
+          emitStmt(S, Out);
+        break;
+      }
+      if (Live.empty())
+        break;
+      llvm::SmallVector<uint32_t, 8> Arms;
+      for (unsigned Arm : Live)
+      {
+        bool IsElse = Unconditional && Arm == Live.back();
+        Arms.push_back(IsElse ? FlatAST::None : emit(Old.getArmCondition(N, Arm)));
+        Arms.push_back(emitBody(Old.getArmBody(N, Arm)));
+      }
+      uint32_t Table = F.Extra.size();
+      F.Extra.append(Arms.begin(), Arms.end());
+      Out.push_back(add(FlatAST::IfElse, Table, Live.size()));
+      break;
+    }
+    case FlatAST::Loop: {
+      llvm::Optional<int32_t> Known = getConstant(Old.getLoopCondition(N));
+      if (Known && !*Known)
+      {
+        ++NumDeadLoops;
+        break;
+      }
+      FlatAST::NodeId Cond = emit(Old.getLoopCondition(N));
+      uint32_t Body = emitBody(Old.getLoopBody(N));
+      LoopHints Hints = Old.getLoopHints(N);
+      uint32_t Table = F.Extra.size();
+      F.Extra.append({Hints.Unroll, Hints.Vectorize, Body});
+      Out.push_back(add(FlatAST::Loop, Cond, Table));
+      break;
+    }
+    default:
+      llvm_unreachable("expression used as a statement");
+    }
+  }
+
+public:
+  FlatSimplifier(const FlatAST &Old) : Old(Old) { F.Symbols = &Old.getSymbols(); }
+
+  FlatAST run()
+  {
+    analyze();
+    for (FlatAST::NodeId S : Old.getStatements())
+      emitStmt(S, F.Statements);
+    return std::move(F);
+  }
+};
+
+AST *Simplify::simplify(AST *Tree, ASTContext &Ctx)
+{
+  ASTSimplifier Simplifier(Ctx);
+  Tree->accept(Simplifier);
+  return Simplifier.getResult();
+}
+
+FlatAST Simplify::simplify(const FlatAST &Tree)
+{
+  return FlatSimplifier(Tree).run();
+}
@@ -0,0 +1,22 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "AST.h"
+#include "FlatAST.h"
+
+// Simplify folds constant subexpressions and algebraic identities and removes
+// if arms and loops whose condition is constant false. It runs after Sema, so
+// Sema's errors in the code it removes are still reported; CodeGen does not
+// report a division by zero under such a condition either.
+class Simplify {
+public:
+  // New nodes are allocated in Ctx; subtrees that do not change are shared.
+  AST *simplify(AST *Tree, ASTContext &Ctx);
+  FlatAST simplify(const FlatAST &Tree);
+};
+
+// Evaluate Op with the semantics of the generated code: arithmetic wraps, ^
+// with an exponent <= 0 is 1, and division is left alone when it would trap.
+bool evaluate(BinaryOp::Operator Op, int32_t L, int32_t R, int32_t &Result);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+
+// SymbolTable interns identifiers while parsing and gives each distinct name a
+// dense id starting at 0. Later phases index plain vectors with the id instead
+// of hashing the name again.
+class SymbolTable
+{
+  llvm::StringMap<uint32_t> IDs;
+  llvm::SmallVector<llvm::StringRef, 0> Names; // spelling per id, owned by IDs
+
+public:
+  uint32_t intern(llvm::StringRef Name)
+  {
+    auto Res = IDs.try_emplace(Name, Names.size());
+    if (Res.second)
+      Names.push_back(Res.first->getKey());
+    return Res.first->second;
+  }
+
+  llvm::StringRef getName(uint32_t ID) const { return Names[ID]; }
+
+  // number of distinct identifiers, i.e. one past the largest id
+  size_t size() const { return Names.size(); }
+};
+
+#endif
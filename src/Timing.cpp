@@ -0,0 +1,102 @@
+#include "Timing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace llvm;
+
+namespace
+{
+  bool ReportEnabled = false;
+
+  // Peak RSS of the process when a phase started and when it ended.
+  struct RSSRecord
+  {
+    std::string Description;
+    unsigned Depth;
+    size_t Before, After;
+  };
+
+  SmallVector<RSSRecord, 8> RSSRecords;
+  unsigned Depth = 0;
+
+  TimerGroup &getGroup()
+  {
+    static TimerGroup Group("gsm", "GSM compilation phases");
+    return Group;
+  }
+
+  // The timer of each phase name; phases that run more than once accumulate.
+  StringMap<Timer> &getTimers()
+  {
+    static StringMap<Timer> Timers;
+    return Timers;
+  }
+
+  // High-water mark of the resident set size in bytes, or 0 if unknown.
+  size_t getPeakRSS()
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage Usage;
+    if (getrusage(RUSAGE_SELF, &Usage))
+      return 0;
+#if defined(__APPLE__)
+    return Usage.ru_maxrss;
+#else
+    return size_t(Usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+  }
+}
+
+PhaseTimer::PhaseTimer(StringRef Name, StringRef Description)
+    : Trace(Name), T(nullptr), Record(0)
+{
+  if (!ReportEnabled)
+    return;
+
+  Record = RSSRecords.size();
+  RSSRecords.push_back({Description.str(), Depth++, getPeakRSS(), 0});
+
+  TimerGroup &Group = getGroup();
+  Timer &PhaseT = getTimers()[Name];
+  if (!PhaseT.isInitialized())
+    PhaseT.init(Name, Description, Group);
+  T = &PhaseT;
+  T->startTimer();
+}
+
+PhaseTimer::~PhaseTimer()
+{
+  if (!T)
+    return;
+  T->stopTimer();
+  RSSRecords[Record].After = getPeakRSS();
+  --Depth;
+}
+
+void PhaseTimer::enableReport() { ReportEnabled = true; }
+
+void PhaseTimer::printReport(raw_ostream &OS)
+{
+  if (!ReportEnabled)
+    return;
+  // Reset the timers so the group does not print them again when destroyed.
+  getGroup().print(OS, /*ResetAfterPrint=*/true);
+
+  OS << "===" << std::string(73, '-') << "===\n"
+     << "                        Peak resident set size per phase\n"
+     << "===" << std::string(73, '-') << "===\n\n"
+     << "  Peak (MiB)  Growth (MiB)  Name\n";
+  for (const RSSRecord &R : RSSRecords)
+    OS << format("  %10.1f  %12.1f  ", R.After / 1048576.0,
+                 (R.After - R.Before) / 1048576.0)
+       << std::string(2 * R.Depth, ' ') << R.Description << "\n";
+  OS << "\n";
+  OS.flush();
+}
@@ -0,0 +1,30 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+// PhaseTimer measures one compiler phase for as long as it is in scope. The
+// phase is timed in the "gsm" timer group when the report is enabled, becomes
+// an event of the -ftime-trace profile when the profiler is running, and has
+// the peak resident set size sampled before and after it. Phases may nest.
+class PhaseTimer
+{
+  llvm::TimeTraceScope Trace;
+  llvm::Timer *T;  // null unless the report is enabled
+  unsigned Record; // index of this phase in the peak RSS table
+
+public:
+  PhaseTimer(llvm::StringRef Name, llvm::StringRef Description);
+  ~PhaseTimer();
+
+  // Turn on timing and peak RSS sampling for the phases started afterwards.
+  static void enableReport();
+
+  // Print the phase times and the peak RSS of each phase.
+  static void printReport(llvm::raw_ostream &OS);
+};
+
+#endif
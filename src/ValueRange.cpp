@@ -0,0 +1,478 @@
+#include "ValueRange.h"
+#include "Simplify.h"
+#include "llvm/ADT/ArrayRef.h"
+#include <algorithm>
+
+using namespace llvm;
+
+ValueRange ValueRange::join(ValueRange Other) const
+{
+  if (isEmpty())
+    return Other;
+  if (Other.isEmpty())
+    return *this;
+  return {std::min(Lo, Other.Lo), std::max(Hi, Other.Hi)};
+}
+
+ValueRange ValueRange::meet(ValueRange Other) const
+{
+  ValueRange R{std::max(Lo, Other.Lo), std::min(Hi, Other.Hi)};
+  return R.isEmpty() ? empty() : R;
+}
+
+namespace {
+// Bounds computed in 64 bits; a range that leaves i32 may wrap to any value.
+ValueRange fromBounds(int64_t Lo, int64_t Hi)
+{
+  if (Lo < INT32_MIN || Hi > INT32_MAX)
+    return ValueRange::full();
+  return {int32_t(Lo), int32_t(Hi)};
+}
+
+// The hull of F over the corners of L and R. That covers every operand pair
+// for +, - and *, and for / while R keeps one sign.
+template <typename Fn> ValueRange corners(ValueRange L, ValueRange R, Fn F)
+{
+  int64_t C[] = {F(L.Lo, R.Lo), F(L.Lo, R.Hi), F(L.Hi, R.Lo), F(L.Hi, R.Hi)};
+  return fromBounds(*std::min_element(std::begin(C), std::end(C)), *std::max_element(std::begin(C), std::end(C)));
+}
+
+ValueRange divide(ValueRange L, ValueRange R)
+{
+  auto Div = [](int64_t A, int64_t B) { return A / B; };
+  ValueRange Result = ValueRange::empty();
+  if (R.Lo < 0)
+    Result = Result.join(corners(L, {R.Lo, std::min(R.Hi, -1)}, Div));
+  if (R.Hi > 0)
+    Result = Result.join(corners(L, {std::max(R.Lo, 1), R.Hi}, Div));
+  return Result;
+}
+
+// The remainder has the sign of L and is smaller than the largest |R|.
+ValueRange remainder(ValueRange L, ValueRange R)
+{
+  if (R.isConstant(0))
+    return ValueRange::empty();
+  int64_t Max = std::max(-int64_t(R.Lo), int64_t(R.Hi)) - 1;
+  return fromBounds(L.Lo >= 0 ? 0 : std::max<int64_t>(L.Lo, -Max), L.Hi <= 0 ? 0 : std::min<int64_t>(L.Hi, Max));
+}
+
+// For bases >= 1 the power grows with both operands; bases 0 and 1 stay <= 1.
+ValueRange power(ValueRange L, ValueRange R)
+{
+  if (R.Hi <= 0)
+    return ValueRange::constant(1);
+  if (L.Lo < 0)
+    return ValueRange::full();
+  int64_t Hi = 1;
+  if (L.Hi > 1)
+    for (int32_t Exp = 0; Exp != R.Hi && Hi <= INT32_MAX; ++Exp)
+      Hi *= L.Hi;
+  return fromBounds(L.Lo > 0 ? 1 : 0, Hi);
+}
+
+// The operator with its operands swapped: a < b is b > a.
+BinaryOp::Operator mirror(BinaryOp::Operator Op)
+{
+  switch (Op)
+  {
+  case BinaryOp::Lower:
+    return BinaryOp::Greater;
+  case BinaryOp::LowerEqual:
+    return BinaryOp::GreaterEqual;
+  case BinaryOp::Greater:
+    return BinaryOp::Lower;
+  case BinaryOp::GreaterEqual:
+    return BinaryOp::LowerEqual;
+  default:
+    return Op;
+  }
+}
+
+// The comparison that holds exactly when Op fails: a < b fails when a >= b.
+BinaryOp::Operator negate(BinaryOp::Operator Op)
+{
+  switch (Op)
+  {
+  case BinaryOp::Lower:
+    return BinaryOp::GreaterEqual;
+  case BinaryOp::LowerEqual:
+    return BinaryOp::Greater;
+  case BinaryOp::Greater:
+    return BinaryOp::LowerEqual;
+  case BinaryOp::GreaterEqual:
+    return BinaryOp::Lower;
+  case BinaryOp::DoubleEqual:
+    return BinaryOp::NotEqual;
+  case BinaryOp::NotEqual:
+    return BinaryOp::DoubleEqual;
+  default:
+    return Op;
+  }
+}
+
+bool isComparison(BinaryOp::Operator Op)
+{
+  return negate(Op) != Op;
+}
+
+bool divisionMayTrap(BinaryOp::Operator Op, ValueRange L, ValueRange R)
+{
+  if ((Op != BinaryOp::Div && Op != BinaryOp::Mod) || L.isEmpty() || R.isEmpty())
+    return false;
+  return R.contains(0) || (L.contains(INT32_MIN) && R.contains(-1));
+}
+// 0 or 1 for a comparison or and/or whose result the ranges decide, or both.
+ValueRange compare(BinaryOp::Operator Op, ValueRange L, ValueRange R)
+{
+  auto Decided = [](bool True, bool False) {
+    return True ? ValueRange::constant(1) : False ? ValueRange::constant(0) : ValueRange{0, 1};
+  };
+  bool Disjoint = L.Hi < R.Lo || R.Hi < L.Lo;
+  switch (Op)
+  {
+  case BinaryOp::Lower:
+    return Decided(L.Hi < R.Lo, L.Lo >= R.Hi);
+  case BinaryOp::LowerEqual:
+    return Decided(L.Hi <= R.Lo, L.Lo > R.Hi);
+  case BinaryOp::Greater:
+    return Decided(L.Lo > R.Hi, L.Hi <= R.Lo);
+  case BinaryOp::GreaterEqual:
+    return Decided(L.Lo >= R.Hi, L.Hi < R.Lo);
+  case BinaryOp::DoubleEqual:
+    return Decided(false, Disjoint);
+  case BinaryOp::NotEqual:
+    return Decided(Disjoint, false);
+  case BinaryOp::And:
+    return Decided(!L.contains(0) && !R.contains(0), L.isConstant(0) || R.isConstant(0));
+  case BinaryOp::Or:
+    return Decided(!L.contains(0) || !R.contains(0), L.isConstant(0) && R.isConstant(0));
+  default:
+    return {0, 1};
+  }
+}
+} // namespace
+
+ValueRange getBinaryRange(BinaryOp::Operator Op, ValueRange L, ValueRange R)
+{
+  if (L.isEmpty() || R.isEmpty())
+    return ValueRange::empty();
+  int32_t Value;
+  if (L.Lo == L.Hi && R.Lo == R.Hi && evaluate(Op, L.Lo, R.Lo, Value))
+    return ValueRange::constant(Value);
+  switch (Op)
+  {
+  case BinaryOp::Plus:
+    return corners(L, R, [](int64_t A, int64_t B) { return A + B; });
+  case BinaryOp::Minus:
+    return corners(L, R, [](int64_t A, int64_t B) { return A - B; });
+  case BinaryOp::Mul:
+    return corners(L, R, [](int64_t A, int64_t B) { return A * B; });
+  case BinaryOp::Div:
+    return divide(L, R);
+  case BinaryOp::Mod:
+    return remainder(L, R);
+  case BinaryOp::Power:
+    return power(L, R);
+  default:
+    return compare(Op, L, R);
+  }
+}
+
+void RangeAnalysis::rollback(Mark M)
+{
+  while (Trail.size() > M)
+  {
+    auto Entry = Trail.pop_back_val();
+    NumEmpty += Entry.second.isEmpty() - Vars[Entry.first].isEmpty();
+    Vars[Entry.first] = Entry.second;
+  }
+  --Depth;
+}
+
+ValueRange RangeAnalysis::eval(Expr *E, bool *MayTrap)
+{
+  if (auto *F = dyn_cast<Factor>(E))
+  {
+    if (F->getValueKind() == Factor::Ident)
+      return Vars[F->getSymbol()];
+    int Value;
+    if (F->getVal().getAsInteger(10, Value))
+      return ValueRange::full();
+    return ValueRange::constant(Value);
+  }
+  auto *Op = cast<BinaryOp>(E);
+  ValueRange L = eval(Op->getLeft(), MayTrap);
+  ValueRange R = eval(Op->getRight(), MayTrap);
+  if (MayTrap && divisionMayTrap(Op->getOperator(), L, R))
+    *MayTrap = true;
+  return getBinaryRange(Op->getOperator(), L, R);
+}
+
+// Operands come before their operator, so one forward pass over the subtree
+// sees every operand range before it is needed.
+ValueRange RangeAnalysis::eval(const FlatAST &F, FlatAST::NodeId Root, bool *MayTrap)
+{
+  FlatAST::NodeId Begin = F.getSubtreeBegin(Root);
+  FlatScratch.assign(Root - Begin + 1, ValueRange::full());
+  for (FlatAST::NodeId N = Begin; N <= Root; ++N)
+  {
+    switch (F.getKind(N))
+    {
+    case FlatAST::Number:
+      FlatScratch[N - Begin] = ValueRange::constant(F.getValue(N));
+      break;
+    case FlatAST::Ident:
+      FlatScratch[N - Begin] = Vars[F.getSymbol(N)];
+      break;
+    case FlatAST::Binary: {
+      ValueRange L = FlatScratch[F.getLeft(N) - Begin], R = FlatScratch[F.getRight(N) - Begin];
+      if (MayTrap && divisionMayTrap(F.getOperator(N), L, R))
+        *MayTrap = true;
+      FlatScratch[N - Begin] = getBinaryRange(F.getOperator(N), L, R);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  return FlatScratch.back();
+}
+
+// Only comparisons against a variable narrow anything; Other is the range of
+// the operand it is compared with.
+void RangeAnalysis::narrow(uint32_t Sym, BinaryOp::Operator Op, ValueRange Other)
+{
+  ValueRange Old = Vars[Sym];
+  ValueRange Allowed;
+  switch (Op)
+  {
+  case BinaryOp::Lower:
+    Allowed = Other.Hi == INT32_MIN ? ValueRange::empty() : ValueRange{INT32_MIN, Other.Hi - 1};
+    break;
+  case BinaryOp::LowerEqual:
+    Allowed = {INT32_MIN, Other.Hi};
+    break;
+  case BinaryOp::Greater:
+    Allowed = Other.Lo == INT32_MAX ? ValueRange::empty() : ValueRange{Other.Lo + 1, INT32_MAX};
+    break;
+  case BinaryOp::GreaterEqual:
+    Allowed = {Other.Lo, INT32_MAX};
+    break;
+  case BinaryOp::DoubleEqual:
+    Allowed = Other;
+    break;
+  case BinaryOp::NotEqual:
+    // Only a constant at either end of the range can be cut off.
+    if (Other.Lo != Other.Hi)
+      return;
+    Allowed = Old;
+    if (Old.Lo == Other.Lo)
+      Allowed = Old.Lo == INT32_MAX ? ValueRange::empty() : ValueRange{Old.Lo + 1, Old.Hi};
+    else if (Old.Hi == Other.Hi)
+      Allowed = Old.Hi == INT32_MIN ? ValueRange::empty() : ValueRange{Old.Lo, Old.Hi - 1};
+    break;
+  default:
+    return;
+  }
+  if (Other.isEmpty())
+    Allowed = ValueRange::empty();
+  ValueRange New = Old.meet(Allowed);
+  if (New != Old)
+    set(Sym, New);
+}
+
+// The ranges that hold after either of two assumptions: each is applied on
+// its own, and a variable narrowed by both gets the join of the two.
+void RangeAnalysis::assumeEither(function_ref<void()> AssumeFirst, function_ref<void()> AssumeSecond)
+{
+  SmallVector<std::pair<uint32_t, ValueRange>, 8> Sides[2];
+  bool Dead[2];
+  for (unsigned Side = 0; Side != 2; ++Side)
+  {
+    Mark M = mark();
+    (Side ? AssumeSecond : AssumeFirst)();
+    Dead[Side] = isUnreachable();
+    for (const auto &Entry : makeArrayRef(Trail).drop_front(M))
+      Sides[Side].emplace_back(Entry.first, Vars[Entry.first]);
+    rollback(M);
+  }
+  // Only the side that can hold narrows anything on its own.
+  if (Dead[0] || Dead[1])
+  {
+    for (const auto &Entry : Sides[Dead[0] ? 1 : 0])
+      set(Entry.first, Entry.second);
+    return;
+  }
+  for (const auto &First : Sides[0])
+    for (const auto &Second : Sides[1])
+      if (First.first == Second.first && Vars[First.first] != First.second.join(Second.second))
+        set(First.first, First.second.join(Second.second));
+}
+
+// A condition whose range rules out the outcome assumed leaves no code to run.
+bool RangeAnalysis::assumeConstant(ValueRange Cond, bool Holds)
+{
+  if (Holds ? Cond.isConstant(0) : !Cond.contains(0))
+  {
+    set(Reach, ValueRange::empty());
+    return true;
+  }
+  return false;
+}
+
+// An and holds when both operands do and an or fails when both do; in the
+// other two cases one of the operands does, which assumeEither covers.
+void RangeAnalysis::assume(Expr *Cond, bool Holds)
+{
+  if (assumeConstant(eval(Cond), Holds))
+    return;
+  auto *Op = dyn_cast<BinaryOp>(Cond);
+  if (!Op)
+  {
+    // A variable used as a condition is nonzero, or zero when it fails.
+    auto *F = cast<Factor>(Cond);
+    if (F->getValueKind() == Factor::Ident)
+      narrow(F->getSymbol(), Holds ? BinaryOp::NotEqual : BinaryOp::DoubleEqual, ValueRange::constant(0));
+    return;
+  }
+  if (Op->getOperator() == (Holds ? BinaryOp::And : BinaryOp::Or))
+  {
+    assume(Op->getLeft(), Holds);
+    assume(Op->getRight(), Holds);
+    return;
+  }
+  if (Op->getOperator() == (Holds ? BinaryOp::Or : BinaryOp::And))
+  {
+    assumeEither([&] { assume(Op->getLeft(), Holds); }, [&] { assume(Op->getRight(), Holds); });
+    return;
+  }
+  if (!isComparison(Op->getOperator()))
+    return;
+  auto IsVar = [](Expr *E) {
+    auto *F = dyn_cast<Factor>(E);
+    return F && F->getValueKind() == Factor::Ident ? F : nullptr;
+  };
+  Factor *LeftVar = IsVar(Op->getLeft());
+  Factor *RightVar = IsVar(Op->getRight());
+  if (!LeftVar && !RightVar)
+    return;
+  BinaryOp::Operator Cmp = Holds ? Op->getOperator() : negate(Op->getOperator());
+  ValueRange L = eval(Op->getLeft());
+  ValueRange R = eval(Op->getRight());
+  if (LeftVar)
+    narrow(LeftVar->getSymbol(), Cmp, R);
+  if (RightVar)
+    narrow(RightVar->getSymbol(), mirror(Cmp), L);
+}
+
+void RangeAnalysis::assume(const FlatAST &F, FlatAST::NodeId Cond, bool Holds)
+{
+  if (assumeConstant(eval(F, Cond), Holds))
+    return;
+  if (F.getKind(Cond) == FlatAST::Ident)
+  {
+    narrow(F.getSymbol(Cond), Holds ? BinaryOp::NotEqual : BinaryOp::DoubleEqual, ValueRange::constant(0));
+    return;
+  }
+  if (F.getKind(Cond) != FlatAST::Binary)
+    return;
+  BinaryOp::Operator Op = F.getOperator(Cond);
+  FlatAST::NodeId Left = F.getLeft(Cond), Right = F.getRight(Cond);
+  if (Op == (Holds ? BinaryOp::And : BinaryOp::Or))
+  {
+    assume(F, Left, Holds);
+    assume(F, Right, Holds);
+    return;
+  }
+  if (Op == (Holds ? BinaryOp::Or : BinaryOp::And))
+  {
+    assumeEither([&] { assume(F, Left, Holds); }, [&] { assume(F, Right, Holds); });
+    return;
+  }
+  if (!isComparison(Op))
+    return;
+  bool LeftVar = F.getKind(Left) == FlatAST::Ident;
+  bool RightVar = F.getKind(Right) == FlatAST::Ident;
+  if (!LeftVar && !RightVar)
+    return;
+  BinaryOp::Operator Cmp = Holds ? Op : negate(Op);
+  ValueRange L = eval(F, Left);
+  ValueRange R = eval(F, Right);
+  if (LeftVar)
+    narrow(F.getSymbol(Left), Cmp, R);
+  if (RightVar)
+    narrow(F.getSymbol(Right), mirror(Cmp), L);
+}
+
+void RangeAnalysis::endArm(Mark M, ArmStates &Arms)
+{
+  unsigned Arm = Arms.NumArms++;
+  for (const auto &Entry : makeArrayRef(Trail).drop_front(M))
+  {
+    uint32_t Sym = Entry.first;
+    auto Inserted = Arms.Vars.try_emplace(Sym, ArmStates::Written{Vars[Sym], 1, Arm});
+    ArmStates::Written &W = Inserted.first->second;
+    if (Inserted.second || W.LastArm == Arm)
+      continue;
+    W.Range = W.Range.join(Vars[Sym]);
+    ++W.NumArms;
+    W.LastArm = Arm;
+  }
+  rollback(M);
+}
+
+void RangeAnalysis::joinArms(const ArmStates &Arms, bool HasElse)
+{
+  for (const auto &Entry : Arms.Vars)
+  {
+    ValueRange R = Entry.second.Range;
+    // Some path through the chain leaves the variable as it was.
+    if (!HasElse || Entry.second.NumArms < Arms.NumArms)
+      R = R.join(Vars[Entry.first]);
+    set(Entry.first, R);
+  }
+}
+
+// The body runs over the ranges at its top, which are then joined with those
+// at its end until nothing changes. A bound still moving after a few rounds
+// jumps to the end of i32, and the condition narrows it again in the body, so
+// a counter tested against a bound keeps that bound inside the loop.
+RangeAnalysis::Mark RangeAnalysis::beginLoop(function_ref<void()> AssumeCond, function_ref<void()> RunBody)
+{
+  const unsigned RoundsBeforeWidening = 3;
+  SmallVector<std::pair<uint32_t, ValueRange>, 8> Ends;
+  for (unsigned Round = 0;; ++Round)
+  {
+    Mark M = mark();
+    AssumeCond();
+    RunBody();
+    Ends.clear();
+    for (const auto &Entry : makeArrayRef(Trail).drop_front(M))
+      Ends.emplace_back(Entry.first, Vars[Entry.first]);
+    rollback(M);
+
+    bool Changed = false;
+    for (const auto &End : Ends)
+    {
+      ValueRange Old = Vars[End.first];
+      ValueRange New = Old.join(End.second);
+      if (New == Old)
+        continue;
+      if (Round >= RoundsBeforeWidening)
+      {
+        if (New.Lo < Old.Lo)
+          New.Lo = INT32_MIN;
+        if (New.Hi > Old.Hi)
+          New.Hi = INT32_MAX;
+      }
+      set(End.first, New);
+      Changed = true;
+    }
+    if (!Changed)
+      break;
+  }
+  Mark M = mark();
+  AssumeCond();
+  return M;
+}
@@ -0,0 +1,139 @@
+#ifndef VALUERANGE_H
+#define VALUERANGE_H
+
+#include "AST.h"
+#include "FlatAST.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include <cstdint>
+#include <vector>
+
+// A signed interval [Lo, Hi] of i32 values. Lo > Hi is the empty range of a
+// value that is never computed, e.g. in code after an impossible condition.
+struct ValueRange
+{
+  int32_t Lo = INT32_MIN;
+  int32_t Hi = INT32_MAX;
+
+  static ValueRange full() { return {}; }
+  static ValueRange empty() { return {INT32_MAX, INT32_MIN}; }
+  static ValueRange constant(int32_t V) { return {V, V}; }
+
+  bool isEmpty() const { return Lo > Hi; }
+  bool isFull() const { return Lo == INT32_MIN && Hi == INT32_MAX; }
+  bool isConstant(int32_t V) const { return Lo == V && Hi == V; }
+  bool contains(int32_t V) const { return Lo <= V && V <= Hi; }
+  bool isNonNegative() const { return Lo >= 0; }
+  bool isPositive() const { return Lo > 0; }
+
+  bool operator==(const ValueRange &Other) const { return Lo == Other.Lo && Hi == Other.Hi; }
+  bool operator!=(const ValueRange &Other) const { return !(*this == Other); }
+
+  ValueRange join(ValueRange Other) const;
+  ValueRange meet(ValueRange Other) const;
+};
+
+// The range of Op applied to any values of L and R. Arithmetic wraps like the
+// generated code, so a bound that could overflow gives the full range.
+ValueRange getBinaryRange(BinaryOp::Operator Op, ValueRange L, ValueRange R);
+
+// RangeAnalysis tracks the range of every variable while CodeGen walks the
+// program in execution order. A condition narrows the ranges in the code it
+// guards, an if chain joins the ranges at the end of its arms, and a loop body
+// starts from ranges that hold on every iteration, found by running the body
+// over the ranges until they stop growing. Bodies hold only assignments, so if
+// chains and loops never nest. While some variable has an empty range, the
+// code being walked never runs.
+class RangeAnalysis
+{
+  std::vector<ValueRange> Vars;                                  // by symbol id, then Reach
+  llvm::SmallVector<std::pair<uint32_t, ValueRange>, 0> Trail;  // overwritten ranges
+  unsigned Depth = 0;                                            // open marks
+  unsigned NumEmpty = 0;                                         // variables with an empty range
+  uint32_t Reach;                                                // empty where no code runs, else full
+
+  std::vector<ValueRange> FlatScratch; // operand ranges while evaluating a flat expression
+
+  void narrow(uint32_t Sym, BinaryOp::Operator Op, ValueRange Other);
+  void assumeEither(llvm::function_ref<void()> AssumeFirst, llvm::function_ref<void()> AssumeSecond);
+  bool assumeConstant(ValueRange Cond, bool Holds);
+  ValueRange eval(Expr *E, bool *MayTrap);
+
+public:
+  // A point to roll the ranges back to.
+  using Mark = size_t;
+
+  // The ranges at the end of each arm of an if chain, for the variables it writes.
+  struct ArmStates
+  {
+    struct Written
+    {
+      ValueRange Range; // joined over the arms that write the variable
+      unsigned NumArms; // how many arms write it
+      unsigned LastArm; // the last of them
+    };
+    llvm::DenseMap<uint32_t, Written> Vars;
+    unsigned NumArms = 0;
+  };
+
+  explicit RangeAnalysis(size_t NumSymbols = 0) : Vars(NumSymbols + 1), Reach(NumSymbols) {}
+
+  ValueRange get(uint32_t Sym) const { return Vars[Sym]; }
+  void set(uint32_t Sym, ValueRange R)
+  {
+    if (Depth)
+      Trail.emplace_back(Sym, Vars[Sym]);
+    NumEmpty += R.isEmpty() - Vars[Sym].isEmpty();
+    Vars[Sym] = R;
+  }
+
+  // No execution reaches the code being walked, e.g. after a condition that
+  // cannot hold.
+  bool isUnreachable() const { return NumEmpty != 0; }
+
+  Mark mark()
+  {
+    ++Depth;
+    return Trail.size();
+  }
+  void rollback(Mark M);
+
+  ValueRange eval(Expr *E) { return eval(E, nullptr); }
+  ValueRange eval(const FlatAST &F, FlatAST::NodeId Root, bool *MayTrap = nullptr);
+
+  // Whether a / or % in the expression may trap, on a divisor that can be
+  // zero or on INT_MIN divided by -1.
+  bool mayTrap(Expr *E)
+  {
+    bool Traps = false;
+    eval(E, &Traps);
+    return Traps;
+  }
+  bool mayTrap(const FlatAST &F, FlatAST::NodeId Root)
+  {
+    bool Traps = false;
+    eval(F, Root, &Traps);
+    return Traps;
+  }
+
+  // Narrow the ranges to the executions where Cond holds, or where it fails
+  // with Holds unset. A condition that can never do so makes the code it
+  // guards unreachable.
+  void assume(Expr *Cond, bool Holds = true);
+  void assume(const FlatAST &F, FlatAST::NodeId Cond, bool Holds = true);
+
+  // Every arm starts from the ranges before the chain; the chain ends with the
+  // join of all arms, and of the ranges before it when it has no else arm.
+  Mark beginArm() { return mark(); }
+  void endArm(Mark M, ArmStates &Arms);
+  void joinArms(const ArmStates &Arms, bool HasElse);
+
+  // Widen the ranges of the variables the body writes until they hold at the
+  // top of every iteration, then assume the condition for the body. endLoop
+  // leaves those ranges, which also hold once the loop exits.
+  Mark beginLoop(llvm::function_ref<void()> AssumeCond, llvm::function_ref<void()> RunBody);
+  void endLoop(Mark M) { rollback(M); }
+};
+
+#endif